@@ -6,6 +6,9 @@
     "hi %s\n", #a)
 #define g (a)
 #define myVar b + c
+#define SQ(x) ((x) * (x))
+#define PLUS_C(x) ((x) + c)
+#define TMP tmp
 void print_int(int num)
 {
     int b = 3;
@@ -29,6 +32,8 @@ int main()
     {
         int tmp = i * i;
         int last = tmp * tmp;
-        printf("hello %d\n", last + myVar);
+        int square = SQ(TMP);
+        int both = PLUS_C(TMP);
+        printf("hello %d\n", last + square + both + myVar);
     }
 }
\ No newline at end of file
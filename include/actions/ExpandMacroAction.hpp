@@ -4,14 +4,26 @@
 #include <clang/Tooling/Core/Replacement.h>
 #include <memory>
 
+/**
+ * @brief What ExpandMacroAction does with the main file
+ *
+ */
+enum class ExpandMode
+{
+    AllMacros,        // expand every macro, keeping only the #includes
+    ConditionalsOnly, // keep only the live branches of #if/#ifdef/..., leaving everything else as written
+    Unhygienic        // expand only the main file's macros that would keep symbols from being renamed
+};
+
 class ExpandMacroAction : public clang::PreprocessOnlyAction
 {
 
 public:
-    ExpandMacroAction(clang::tooling::Replacements *replacements);
+    ExpandMacroAction(clang::tooling::Replacements *replacements, ExpandMode mode = ExpandMode::AllMacros);
     virtual void ExecuteAction() override;
-    static std::unique_ptr<clang::tooling::FrontendActionFactory> newExpandMacroAction(clang::tooling::Replacements *replacements);
+    static std::unique_ptr<clang::tooling::FrontendActionFactory> newExpandMacroAction(clang::tooling::Replacements *replacements, ExpandMode mode = ExpandMode::AllMacros);
 
 private:
     clang::tooling::Replacements *replacements;
+    ExpandMode mode;
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <clang/Frontend/FrontendActions.h>
 #include <clang/Tooling/Core/Replacement.h>
 #include <memory>
+#include <string>
 
 class FormatAction : public clang::PreprocessorFrontendAction
 {
@@ -11,6 +12,14 @@ public:
     virtual void ExecuteAction() override;
     static std::unique_ptr<clang::tooling::FrontendActionFactory> newFormatAction(clang::tooling::Replacements *replacements);
 
+    /**
+     * @brief Does what the action does, straight on the code, without a compiler instance
+     *
+     * @param code must be followed by a null character, like the contents of a MemoryBuffer
+     * @return std::string the code without comments and extra whitespace
+     */
+    static std::string format(llvm::StringRef code);
+
 private:
     clang::tooling::Replacements *replacements;
 };
@@ -3,19 +3,32 @@
 #include <clang/Rewrite/Core/Rewriter.h>
 #include <clang/Tooling/Tooling.h>
 #include <clang/Tooling/Core/Replacement.h>
+#include <llvm/ADT/StringSet.h>
 #include <memory>
-#include <set>
 #include <string>
 using namespace llvm;
+
+/**
+ * @brief Options for MinifySymbolsAction
+ *
+ */
+struct MinifySymbolsOptions
+{
+    int jobs = 0;                 // max number of threads used to name symbols, 0 for one per hardware thread
+    bool removeUnused = false;    // delete static functions/variables and types that nothing needs
+    bool shortenLiterals = false; // respell integer, character and floating literals as short as their type allows
+};
+
 class MinifySymbolsAction : public clang::ASTFrontendAction
 {
 private:
     clang::tooling::Replacements *replacements;
-    std::set<std::string> *definitions;
+    llvm::StringSet<> *definitions;
     int *firstUnusedSymbol;
+    MinifySymbolsOptions options;
 
 public:
-    MinifySymbolsAction(clang::tooling::Replacements *replacements, std::set<std::string> *definitions, int *firstUnusedSymbol);
+    MinifySymbolsAction(clang::tooling::Replacements *replacements, llvm::StringSet<> *definitions, int *firstUnusedSymbol, MinifySymbolsOptions options);
     virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance &compiler,
                                                                   llvm::StringRef inFile) override;
     /**
@@ -24,5 +37,5 @@ public:
      * @param replacements out
      * @return std::unique_ptr<clang::tooling::FrontendActionFactory>
      */
-    static std::unique_ptr<clang::tooling::FrontendActionFactory> newMinifierAction(clang::tooling::Replacements *replacements, std::set<std::string> *definitions, int *firstUnusedSymbol);
+    static std::unique_ptr<clang::tooling::FrontendActionFactory> newMinifierAction(clang::tooling::Replacements *replacements, llvm::StringSet<> *definitions, int *firstUnusedSymbol, MinifySymbolsOptions options);
 };
@@ -1,25 +1,28 @@
 #pragma once
-#include <clang/Frontend/FrontendAction.h>
+#include <clang/Frontend/FrontendActions.h>
 #include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/StringSet.h>
+#include <util/macrocache.hpp>
 #include <memory>
-#include <set>
 #include <string>
 
-class PPSymbolsAction : public clang::ASTFrontendAction
+class PPSymbolsAction : public clang::PreprocessOnlyAction
 {
 private:
-    std::set<std::string> *definitions;
+    llvm::StringSet<> *definitions;
+    MacroNameCache *cache;
 
 public:
-    PPSymbolsAction(std::set<std::string> *definitions);
-    virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance &compiler,
-                                                                  llvm::StringRef inFile) override;
+    PPSymbolsAction(llvm::StringSet<> *definitions, MacroNameCache *cache = nullptr);
+    virtual void ExecuteAction() override;
 
     /**
      * @brief
      *
      * @param definitions out, where to put all the found definitions
+     * @param cache if not null, headers it has fresh records for are skipped and their cached names used,
+     * and every other header is recorded into it
      * @return std::unique_ptr<clang::tooling::FrontendActionFactory>
      */
-    static std::unique_ptr<clang::tooling::FrontendActionFactory> newPPSymbolsAction(std::set<std::string> *definitions);
-};
\ No newline at end of file
+    static std::unique_ptr<clang::tooling::FrontendActionFactory> newPPSymbolsAction(llvm::StringSet<> *definitions, MacroNameCache *cache = nullptr);
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Tooling/Tooling.h>
+#include <clang/Tooling/Core/Replacement.h>
+#include <memory>
+#include <string>
+
+/**
+ * @brief Removes the main file's #includes that supply nothing it uses
+ *
+ * Every declaration and macro the main file uses is traced back to the
+ * #include in the main file that first brought its header in, so headers
+ * that are only reached through another kept header are removed as well.
+ * Includes that sit inside a declaration, and headers that define functions
+ * or variables the program links against, are always kept.
+ *
+ */
+class PruneIncludesAction : public clang::ASTFrontendAction
+{
+private:
+    clang::tooling::Replacements *replacements;
+
+public:
+    PruneIncludesAction(clang::tooling::Replacements *replacements);
+    virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance &compiler,
+                                                                  llvm::StringRef inFile) override;
+
+    /**
+     * @brief
+     *
+     * @param replacements out, the deletions of the unneeded #include lines
+     * @return std::unique_ptr<clang::tooling::FrontendActionFactory>
+     */
+    static std::unique_ptr<clang::tooling::FrontendActionFactory> newPruneIncludesAction(clang::tooling::Replacements *replacements);
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <util/tokens.hpp>
+#include <llvm/ADT/StringRef.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Which of several equally valuable candidate sequences wins
+ *
+ */
+enum class CandidateOrder
+{
+    SuffixOrder,  // the first one found while walking the suffix array
+    LongestFirst, // the one with the most tokens
+    ShortestFirst // the one with the fewest tokens
+};
+
+/**
+ * @brief One configuration of the greedy define search
+ *
+ */
+struct DefineStrategy
+{
+    bool niceMacros = true;                          // only replace sequences with matched ()[]{}
+    CandidateOrder order = CandidateOrder::SuffixOrder;
+    bool multiPick = false;                          // commit several defines per suffix array instead of one
+
+    DefineStrategy() = default;
+    DefineStrategy(bool niceMacros, CandidateOrder order, bool multiPick) : niceMacros(niceMacros), order(order), multiPick(multiPick) {}
+};
+
+/**
+ * @brief Options for addDefines
+ *
+ */
+struct AddDefinesOptions
+{
+    std::vector<DefineStrategy> strategies = {DefineStrategy()}; // more than one runs a portfolio
+    int jobs = 0;                                                // max number of worker threads, 0 for one per hardware thread
+    bool sharded = false;                                        // find repeats per top level declaration in parallel
+    int windowSize = 0;                                          // find repeats in windows of this many tokens, 0 to disable
+    std::string checkpointPath;                                  // where the greedy search saves its state, empty to disable
+    int checkpointInterval = 60;                                 // seconds between checkpoints
+    bool resume = false;                                         // start from the checkpoint if it matches the input
+    bool afterIncludes = false;                                  // put the defines after the last #include rather than at the top
+};
+
+/**
+ * @brief Adds macro defines to the top of the file
+ * to minimize repeated token sequences
+ *
+ * When given more than one strategy, every strategy is run on its own thread
+ * over the same token stream and the smallest result is kept.
+ * When sharded, candidate sequences are counted per top level declaration in
+ * parallel, and the counts are merged before committing defines.
+ * When windowed, candidate sequences are counted one window at a time so that,
+ * beyond one token number per token and the table of distinct tokens, memory
+ * does not grow with the size of the file.
+ * The result is left as tokens for renderTokens, rather than as text.
+ * Defines are never named after an identifier the code already spells.
+ * With afterIncludes, the defines go right after the last #include, so that
+ * identifiers of headers the code can't see are never replaced, and the code in
+ * front of them is left as is.
+ *
+ * Only the raw lexer is used, so this runs without a compiler instance.
+ *
+ * @param code must be followed by a null character, like the contents of a MemoryBuffer
+ * @param firstUnusedSymbol the symbol number the first define may use
+ * @param options
+ * @param result out, the code with the defines in front
+ */
+void addDefines(llvm::StringRef code, int firstUnusedSymbol, const AddDefinesOptions &options, TokenStream *result);
+
+/**
+ * @brief The strategies tried by --portfolio
+ *
+ * @param allowUnbalanced whether strategies without nice macros may be used
+ * @return std::vector<DefineStrategy>
+ */
+std::vector<DefineStrategy> definePortfolio(bool allowUnbalanced);
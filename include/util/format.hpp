@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdio>
+#include <llvm/Support/raw_ostream.h>
+
+// the instructions formatStream classifies its input with
+enum class FormatPath
+{
+    Detect, // the best the CPU has
+    Scalar,
+    SSE42,
+    AVX2
+};
+
+// whether the CPU can run a path
+bool formatPathSupported(FormatPath path);
+
+/**
+ * @brief Removes comments and whitespace from C source without clang
+ *
+ * Tokens are split and spaced exactly like FormatAction does, so the output matches
+ * running FormatAction on the same input. The input is read in fixed size blocks and
+ * written out as it is scanned, so memory use doesn't depend on the size of the input.
+ * The input is classified 64 bytes at a time with AVX2 or SSE4.2 when the CPU has them,
+ * and stretches without comments, literals or the first tokens of a directive only have
+ * their whitespace dropped. Everything else goes through a scanner that follows clang's lexer.
+ *
+ * @param in where to read the source from
+ * @param out where to write the minified source
+ * @param path which instructions to use, all of them give the same output
+ * @return true on success
+ * @return false if reading the input failed
+ */
+bool formatStream(std::FILE *in, llvm::raw_ostream &out, FormatPath path = FormatPath::Detect);
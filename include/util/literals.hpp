@@ -0,0 +1,67 @@
+#pragma once
+#include <llvm/ADT/APFloat.h>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief The types a C integer literal can have
+ *
+ */
+enum class IntegerType
+{
+    Int,
+    UnsignedInt,
+    Long,
+    UnsignedLong,
+    LongLong,
+    UnsignedLongLong
+};
+
+/**
+ * @brief Sizes of the integer types on the target, in bits
+ *
+ */
+struct IntegerWidths
+{
+    unsigned intWidth = 32;
+    unsigned longWidth = 64;
+    unsigned longLongWidth = 64;
+};
+
+/**
+ * @brief The shortest integer literal with the given value and type
+ *
+ * Tries decimal, hex and octal with every suffix, and keeps the spellings
+ * that C's rules give the same type for that value.
+ *
+ * @param value
+ * @param type
+ * @param widths
+ * @return std::string the spelling, or empty if no spelling has that type
+ */
+std::string shortestIntegerLiteral(uint64_t value, IntegerType type, const IntegerWidths &widths);
+
+/**
+ * @brief The shortest spelling of a plain character literal's value
+ *
+ * Single characters are written as themselves or with the shortest escape.
+ * In C a character literal is an int, so when integerAllowed is set a
+ * non-negative value may also be written as a decimal integer.
+ *
+ * @param value the literal's value, sign extended from char when char is signed
+ * @param integerAllowed whether an int literal has the same type as the character literal
+ * @return std::string the spelling, or empty for multi-character literals
+ */
+std::string shortestCharacterLiteral(uint32_t value, bool integerAllowed);
+
+/**
+ * @brief The shortest floating literal that reads back as exactly the given value
+ *
+ * Uses the fewest significant digits that round trip, written either with
+ * a decimal point or with an exponent, whichever is shorter.
+ *
+ * @param value must not be negative, the sign of a literal is a separate operator
+ * @param suffix what selects the literal's type, "" for double, "f" for float or "l" for long double
+ * @return std::string the spelling, or empty if the value is not finite
+ */
+std::string shortestFloatingLiteral(const llvm::APFloat &value, const std::string &suffix);
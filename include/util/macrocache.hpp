@@ -0,0 +1,135 @@
+#pragma once
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The names of every macro a header defines, under any condition
+ *
+ * @param code the header's contents, followed by a null character
+ * @return std::vector<std::string>
+ */
+std::vector<std::string> definedMacroNames(llvm::StringRef code);
+
+/**
+ * @brief The names a header's conditional directives test, under any condition
+ *
+ * @param code the header's contents, followed by a null character
+ * @return std::vector<std::string>
+ */
+std::vector<std::string> testedMacroNames(llvm::StringRef code);
+
+/**
+ * @brief An on-disk index of the macro names each header defines
+ *
+ * Records are keyed by the header's real path and a fingerprint of everything
+ * that changes what headers define and include, such as the predefined macros
+ * and the include paths, so one cache file can serve several configurations.
+ * A record is only used while the header's size and modification time match,
+ * and while the same holds for every header it included. Which headers it
+ * included can also depend on macros the main file defines, so records keep
+ * the names the header's conditionals test for the caller to check.
+ *
+ * The file is mapped and read in place, so loading it costs nothing up front.
+ *
+ */
+class MacroNameCache
+{
+public:
+    struct Header
+    {
+        std::string path;                  // real path
+        uint64_t size = 0;                 // in bytes
+        int64_t mtime = 0;                 // nanoseconds since the epoch
+        std::vector<std::string> names;    // every macro it defines, under any condition
+        std::vector<std::string> includes; // real paths of the headers it included
+        std::vector<std::string> tested;   // every name its conditionals test, under any condition
+    };
+
+    /**
+     * @brief Maps the cache at path. A missing or unreadable file is an empty cache
+     *
+     * @param path
+     */
+    explicit MacroNameCache(std::string path);
+
+    // selects the records of one configuration
+    void setFingerprint(uint64_t fingerprint);
+
+    // real paths of the headers recorded for the current configuration
+    std::vector<llvm::StringRef> headers() const;
+
+    /**
+     * @brief Whether the header and every header it included are unchanged since they were recorded
+     *
+     * @param path a real path
+     */
+    bool isFresh(llvm::StringRef path);
+
+    /**
+     * @brief Adds the names the header and every header it included define or test. Headers already added are skipped
+     *
+     * @param path a real path
+     * @param names out, the names they define
+     * @param tested out, the names their conditionals test
+     */
+    void addNames(llvm::StringRef path, llvm::StringSet<> &names, llvm::StringSet<> &tested);
+
+    // fills in a header's size and modification time from the file, false if it can't be read
+    static bool readStatus(Header &header);
+
+    // replaces the record for the header's path in the current configuration once saved
+    void record(Header header);
+
+    /**
+     * @brief Writes the cache back, with this run's records in it
+     *
+     * @return true on success
+     */
+    bool save();
+
+    // whether runs may skip the headers that are fresh
+    bool skippingEnabled() const
+    {
+        return !skipConflict;
+    }
+
+    // skipping headers changed what a run saw, so it has to be done again without
+    void reportSkipConflict()
+    {
+        skipConflict = true;
+    }
+    bool hadSkipConflict() const
+    {
+        return skipConflict;
+    }
+
+private:
+    std::string path;
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    size_t count = 0; // mapped records
+    uint64_t stringsOffset = 0;
+    uint64_t listsOffset = 0;
+    uint64_t fingerprint = 0;
+    size_t first = 0, last = 0; // mapped records of the current configuration
+
+    llvm::StringMap<bool> fresh;      // whether a header's own record is unchanged
+    llvm::StringSet<> added;          // headers whose names were added
+    std::vector<Header> recorded;     // this run's records
+    bool skipConflict = false;
+
+    bool validate();
+    const char *recordAt(size_t i) const;
+    uint64_t fingerprintOf(size_t i) const;
+    llvm::StringRef pathOf(size_t i) const;
+    llvm::StringRef listString(uint32_t index) const;
+    void listOf(size_t i, int field, std::vector<llvm::StringRef> &out) const;
+    int find(llvm::StringRef path) const; // mapped record of the current configuration, or -1
+    bool isUnchanged(size_t i);
+    Header read(size_t i) const;
+};
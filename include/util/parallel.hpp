@@ -0,0 +1,22 @@
+#pragma once
+#include <functional>
+
+/**
+ * @brief Resolves a requested number of threads
+ *
+ * @param jobs the requested number of threads, 0 for one per hardware thread
+ * @return int the number of threads to use, at least 1
+ */
+int resolveJobs(int jobs);
+
+/**
+ * @brief Calls body(i) for every i in [0, count), spread over up to `jobs` threads
+ *
+ * Indices are handed out in increasing order, and the call returns once every
+ * index has been processed. With a single thread, everything runs on the caller's thread.
+ *
+ * @param count the number of indices
+ * @param jobs the requested number of threads, 0 for one per hardware thread
+ * @param body the work to do for each index
+ */
+void parallelFor(int count, int jobs, const std::function<void(int)> &body);
@@ -1,7 +1,65 @@
 #pragma once
+#include <functional>
 #include <string>
-#include <set>
+#include <vector>
 #include <clang/Lex/Token.h>
+#include <llvm/ADT/StringSet.h>
 
-std::pair<int, std::string> toSymbol(int i, const std::set<std::string> &reserved, std::set<std::string> *defines);
-bool isPunctuator(const clang::Token &t);
\ No newline at end of file
+/**
+ * @brief Calculates the next number that can be used for an identifier
+ *
+ * @param i the current number requested
+ * @param isTaken whether a name is already in use; keywords are always skipped
+ * @return std::pair<int, std::string> a pair containing (nextNumber, identifier)
+ */
+std::pair<int, std::string> toSymbol(int i, const std::function<bool(llvm::StringRef)> &isTaken);
+bool isPunctuator(const clang::Token &t);
+
+/**
+ * @brief The identifier for symbol number i, keywords and reserved names included
+ *
+ * Names are built once and shared by every caller, so this is an array lookup
+ * for any number that has been asked for before. Safe to call from several threads.
+ *
+ * @param i the symbol number
+ * @return const std::string& the identifier, valid for the rest of the program
+ */
+const std::string &symbolName(int i);
+
+/**
+ * @brief The symbol number whose identifier is name, the inverse of symbolName
+ *
+ * @param name any identifier
+ * @return int the symbol number, or -1 if symbolName never gives this name
+ */
+int symbolNumber(llvm::StringRef name);
+
+/**
+ * @brief The usable identifiers in symbol number order, with keywords, macros and taken names skipped
+ *
+ * Entries are computed the first time they are asked for, so looking up
+ * the name of an index that was already handed out is a single array index.
+ * Whether a name is taken is only asked once it is about to be handed out.
+ *
+ */
+class SymbolTable
+{
+private:
+    const llvm::StringSet<> *defines; // not owned
+    std::function<bool(llvm::StringRef)> isTaken;
+    std::vector<int> numbers; // symbol number of each usable identifier
+
+    bool isUsable(llvm::StringRef name) const;
+
+public:
+    SymbolTable(const llvm::StringSet<> *defines, std::function<bool(llvm::StringRef)> isTaken);
+
+    /**
+     * @brief The symbol number of the index-th usable identifier
+     *
+     * @param index which usable identifier, starting from 0
+     * @return int a symbol number for symbolName
+     */
+    int number(int index);
+    const std::string &name(int index) { return symbolName(number(index)); }
+};
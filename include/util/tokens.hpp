@@ -0,0 +1,94 @@
+#pragma once
+#include <clang/Basic/TokenKinds.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A file's tokens, in the form the token level stages hand to each other
+ *
+ * Spellings are interned, so equal tokens share a spelling number, and are
+ * stored without line splices. Each token also keeps its kind, whether it
+ * started a line or had whitespace before it, and where it came from in the
+ * source, so that stages can work on tokens without lexing or printing text.
+ *
+ */
+struct TokenStream
+{
+    enum Flags : uint8_t
+    {
+        StartOfLine = 1,  // first token on its line
+        LeadingSpace = 2, // whitespace or a comment came right before it
+        Punctuator = 4,   // see isPunctuator
+    };
+
+    struct Entry
+    {
+        uint32_t spelling;    // index into spellings
+        uint32_t offset;      // where the token starts in the source, NO_OFFSET if a stage made it up
+        clang::tok::TokenKind kind;
+        uint8_t flags;
+    };
+
+    static const uint32_t NO_OFFSET = ~0u;
+
+    std::vector<Entry> entries;
+    std::vector<llvm::StringRef> spellings; // indexed by spelling number
+
+    TokenStream();
+
+    /**
+     * @brief The spelling number for a spelling, copying it in if it's new
+     *
+     * @param spelling
+     * @return uint32_t
+     */
+    uint32_t intern(llvm::StringRef spelling);
+
+    // appends a token
+    void add(llvm::StringRef spelling, clang::tok::TokenKind kind, uint8_t flags, uint32_t offset = NO_OFFSET)
+    {
+        entries.push_back(Entry{intern(spelling), offset, kind, flags});
+    }
+
+    llvm::StringRef spelling(const Entry &entry) const
+    {
+        return spellings[entry.spelling];
+    }
+
+    // owns the spellings, share it to keep them alive longer than the stream
+    std::shared_ptr<llvm::BumpPtrAllocator> getStorage() const
+    {
+        return storage;
+    }
+
+private:
+    std::shared_ptr<llvm::BumpPtrAllocator> storage;
+    llvm::DenseMap<llvm::StringRef, uint32_t> numbers;
+};
+
+/**
+ * @brief Raw lexes C code onto the end of a stream, dropping comments and whitespace
+ *
+ * @param code must be followed by a null character, like the contents of a MemoryBuffer or std::string
+ * @param stream out
+ * @param recordOffsets whether entries remember their offset in code, rather than NO_OFFSET
+ */
+void lexTokens(llvm::StringRef code, TokenStream &stream, bool recordOffsets = true);
+
+/**
+ * @brief Writes out tokens with as little whitespace as still keeps them apart
+ *
+ * There is no space next to punctuators, a space between any other two tokens,
+ * and a newline around every preprocessor line. The one space that matters in
+ * a preprocessor line, between the name and body of an object-like macro that
+ * starts with a punctuator, is kept.
+ *
+ * @param stream
+ * @return std::string
+ */
+std::string renderTokens(const TokenStream &stream);
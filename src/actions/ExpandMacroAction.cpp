@@ -7,13 +7,19 @@
 #include <clang/Tooling/CommonOptionsParser.h>
 #include <clang/Tooling/Tooling.h>
 #include <clang/Lex/MacroArgs.h>
+#include <clang/Lex/MacroInfo.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/Support/CommandLine.h>
 #include <clang/Lex/PreprocessorOptions.h>
 #include <clang/Rewrite/Core/Rewriter.h>
 #include <clang/Lex/Preprocessor.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <sstream>
+#include <vector>
 using namespace std;
 using namespace clang;
 using namespace clang::tooling;
@@ -49,6 +55,366 @@ public:
     }
 };
 
+// records the main file's conditional directives that were evaluated, and the code they skipped
+class ConditionalPPCallbacks : public PPCallbacks
+{
+private:
+    SourceManager &manager;
+    vector<pair<unsigned, unsigned>> &dead; // main file offsets, [begin, end)
+
+    void directive(SourceLocation loc)
+    {
+        if (manager.isWrittenInMainFile(loc))
+        {
+            unsigned offset = manager.getFileOffset(loc);
+            dead.push_back({offset, offset});
+        }
+    }
+
+public:
+    ConditionalPPCallbacks(SourceManager &manager, vector<pair<unsigned, unsigned>> &dead) : manager(manager), dead(dead) {};
+    virtual void If(SourceLocation loc, SourceRange conditionRange, ConditionValueKind conditionValue) override
+    {
+        directive(loc);
+    }
+    virtual void Elif(SourceLocation loc, SourceRange conditionRange, ConditionValueKind conditionValue, SourceLocation ifLoc) override
+    {
+        directive(loc);
+    }
+    virtual void Ifdef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        directive(loc);
+    }
+    virtual void Ifndef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        directive(loc);
+    }
+    virtual void Elifdef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        directive(loc);
+    }
+    virtual void Elifndef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        directive(loc);
+    }
+    virtual void Elifdef(SourceLocation loc, SourceRange conditionRange, SourceLocation ifLoc) override
+    {
+        directive(loc);
+    }
+    virtual void Elifndef(SourceLocation loc, SourceRange conditionRange, SourceLocation ifLoc) override
+    {
+        directive(loc);
+    }
+    virtual void Else(SourceLocation loc, SourceLocation ifLoc) override
+    {
+        directive(loc);
+    }
+    virtual void Endif(SourceLocation loc, SourceLocation ifLoc) override
+    {
+        directive(loc);
+    }
+    virtual void SourceRangeSkipped(SourceRange range, SourceLocation endifLoc) override
+    {
+        if (manager.isWrittenInMainFile(range.getBegin()) && manager.isWrittenInMainFile(range.getEnd()))
+        {
+            dead.push_back({manager.getFileOffset(range.getBegin()), manager.getFileOffset(range.getEnd())});
+        }
+    }
+};
+
+// widens [begin, end) to whole lines, following backslash continuations
+pair<unsigned, unsigned> wholeLines(StringRef code, unsigned begin, unsigned end)
+{
+    size_t lineStart = code.rfind('\n', begin);
+    begin = lineStart == StringRef::npos ? 0 : lineStart + 1;
+    size_t lineEnd = code.find('\n', end);
+    while (lineEnd != StringRef::npos && lineEnd > 0 && code[lineEnd - 1] == '\\')
+    {
+        lineEnd = code.find('\n', lineEnd + 1);
+    }
+    return {begin, lineEnd == StringRef::npos ? code.size() : lineEnd + 1};
+}
+
+// removes the conditional directives and the branches they skip, one whole line at a time
+void stripConditionals(SourceManager &sm, Preprocessor &preproc, Replacements *r)
+{
+    // only directives need their macros expanded to be evaluated
+    vector<pair<unsigned, unsigned>> dead;
+    preproc.addPPCallbacks(make_unique<ConditionalPPCallbacks>(sm, dead));
+    preproc.SetMacroExpansionOnlyInDirectives();
+    preproc.EnterMainSourceFile();
+    Token tok;
+    do
+    {
+        preproc.Lex(tok);
+    } while (!tok.is(tok::eof));
+
+    StringRef code = sm.getBufferData(sm.getMainFileID());
+    for (pair<unsigned, unsigned> &range : dead)
+    {
+        // a skipped range may end at the start of the line after its last directive
+        if (range.second > range.first && code[range.second - 1] == '\n')
+        {
+            --range.second;
+        }
+        range = wholeLines(code, range.first, range.second);
+    }
+    std::sort(dead.begin(), dead.end());
+
+    StringRef filePath = sm.getFileEntryRefForID(sm.getMainFileID())->getName();
+    for (int i = 0, j = 0; i < dead.size(); i = j)
+    {
+        unsigned end = dead[i].second;
+        for (j = i + 1; j < dead.size() && dead[j].first <= end; ++j)
+        {
+            end = max(end, dead[j].second);
+        }
+        cantFail(r->add(Replacement(filePath, dead[i].first, end - dead[i].first, "")));
+    }
+}
+
+// what the main file does with its macros, gathered while preprocessing it
+struct MacroUses
+{
+    struct Expansion
+    {
+        unsigned end = 0;                 // main file offset past the expansion
+        vector<const MacroInfo *> macros; // this macro and every one expanded within it
+        string tokens;                    // what it expands to, separated by spaces
+    };
+
+    map<unsigned, Expansion> expansions;                                 // outermost expansions in the main file's code, by offset
+    DenseMap<const IdentifierInfo *, vector<const MacroInfo *>> defined; // macros defined in the main file
+    DenseSet<const MacroInfo *> needed;                                  // macros whose uses aren't all expanded, or that directives look at
+    DenseSet<const IdentifierInfo *> outside;                            // identifiers spelled outside of the main file
+};
+
+class HygienePPCallbacks : public PPCallbacks
+{
+private:
+    SourceManager &sm;
+    Preprocessor &preproc;
+    MacroUses &uses;
+
+    // whether offset is on a preprocessor line of the main file
+    bool inDirective(unsigned offset)
+    {
+        StringRef code = sm.getBufferData(sm.getMainFileID());
+        unsigned lineStart = wholeLines(code, offset, offset).first;
+        // a line may be the continuation of one before it
+        while (lineStart >= 2 && code[lineStart - 2] == '\\')
+        {
+            lineStart = wholeLines(code, lineStart - 2, lineStart - 2).first;
+        }
+        StringRef line = code.substr(lineStart).ltrim(" \t\f\v");
+        return !line.empty() && line.front() == '#';
+    }
+
+    // the expansion that starts at offset, or the one offset is in the arguments of
+    map<unsigned, MacroUses::Expansion>::iterator enclosingExpansion(unsigned offset)
+    {
+        auto it = uses.expansions.upper_bound(offset);
+        if (it == uses.expansions.begin())
+        {
+            return uses.expansions.end();
+        }
+        --it;
+        return it->first == offset || offset < it->second.end ? it : uses.expansions.end();
+    }
+
+    void keepDefinition(const MacroDefinition &definition)
+    {
+        if (const MacroInfo *info = definition.getMacroInfo())
+        {
+            uses.needed.insert(info);
+        }
+    }
+
+public:
+    HygienePPCallbacks(SourceManager &sm, Preprocessor &preproc, MacroUses &uses) : sm(sm), preproc(preproc), uses(uses) {};
+    virtual void MacroDefined(const Token &macroNameTok, const MacroDirective *md) override
+    {
+        if (sm.isWrittenInMainFile(macroNameTok.getLocation()))
+        {
+            uses.defined[macroNameTok.getIdentifierInfo()].push_back(md->getMacroInfo());
+        }
+    }
+    virtual void MacroExpands(const Token &macroNameTok, const MacroDefinition &definition, SourceRange range, const MacroArgs *args) override
+    {
+        const MacroInfo *info = definition.getMacroInfo();
+        if (info == nullptr)
+        {
+            return;
+        }
+        SourceLocation expansionLoc = sm.getExpansionLoc(range.getBegin());
+        if (!sm.isWrittenInMainFile(expansionLoc))
+        {
+            // a header expanding one of our macros needs its definition
+            uses.needed.insert(info);
+            return;
+        }
+        unsigned offset = sm.getFileOffset(expansionLoc);
+        if (inDirective(offset))
+        {
+            uses.needed.insert(info);
+            return;
+        }
+        // a macro in another one's arguments is written in the main file too, but its
+        // tokens come out of the outer expansion, so it's part of that one
+        auto it = enclosingExpansion(offset);
+        if (it == uses.expansions.end() && range.getBegin().isFileID())
+        {
+            // an expansion that ends inside another one is left alone
+            SourceLocation end = Lexer::getLocForEndOfToken(range.getEnd(), 0, sm, preproc.getLangOpts());
+            if (end.isValid())
+            {
+                it = uses.expansions.try_emplace(offset).first;
+                it->second.end = sm.getFileOffset(end);
+            }
+        }
+        if (it == uses.expansions.end())
+        {
+            uses.needed.insert(info);
+            return;
+        }
+        it->second.macros.push_back(info);
+    }
+    virtual void Ifdef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        keepDefinition(md);
+    }
+    virtual void Ifndef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        keepDefinition(md);
+    }
+    virtual void Defined(const Token &macroNameTok, const MacroDefinition &md, SourceRange range) override
+    {
+        keepDefinition(md);
+    }
+};
+
+// decides which of the main file's macros get in the way of renaming
+class HygieneChecker
+{
+private:
+    SourceManager &sm;
+    const MacroUses &uses;
+    DenseMap<const MacroInfo *, bool> memo;
+
+public:
+    HygieneChecker(SourceManager &sm, const MacroUses &uses) : sm(sm), uses(uses) {}
+
+    /**
+     * @brief Whether a macro has to be expanded for everything it touches to be renamed
+     *
+     * That's the case for a macro of the main file whose body stringizes or pastes,
+     * refers to an identifier nothing outside the main file spells (so one of the
+     * file's own symbols, or one the macro declares), or expands another such macro.
+     *
+     * @param info
+     * @return true if the macro is unhygienic
+     */
+    bool isUnhygienic(const MacroInfo *info)
+    {
+        auto [it, inserted] = memo.try_emplace(info, false); // false while in progress, for recursive macros
+        if (!inserted || !sm.isWrittenInMainFile(info->getDefinitionLoc()))
+        {
+            return it->second;
+        }
+        bool result = false;
+        for (const Token &tok : info->tokens())
+        {
+            if (tok.isOneOf(tok::hash, tok::hashhash, tok::hashat))
+            {
+                result = true;
+                break;
+            }
+            if (!tok.is(tok::identifier))
+            {
+                continue;
+            }
+            const IdentifierInfo *identifier = tok.getIdentifierInfo();
+            if (info->getParameterNum(identifier) >= 0)
+            {
+                continue;
+            }
+            auto defined = uses.defined.find(identifier);
+            if (defined != uses.defined.end())
+            {
+                result = any_of(defined->second.begin(), defined->second.end(), [&](const MacroInfo *other)
+                                { return isUnhygienic(other); });
+            }
+            else if (!identifier->hadMacroDefinition())
+            {
+                result = !uses.outside.contains(identifier);
+            }
+            if (result)
+            {
+                break;
+            }
+        }
+        memo[info] = result;
+        return result;
+    }
+};
+
+// expands only the macros that would keep symbols from being renamed, and removes their definitions
+void expandUnhygienic(SourceManager &sm, Preprocessor &preproc, Replacements *r)
+{
+    MacroUses uses;
+    preproc.addPPCallbacks(make_unique<HygienePPCallbacks>(sm, preproc, uses));
+    preproc.EnterMainSourceFile();
+    Token tok;
+    preproc.Lex(tok);
+    while (!tok.is(tok::eof))
+    {
+        SourceLocation loc = tok.getLocation();
+        if (loc.isMacroID())
+        {
+            SourceLocation expansionLoc = sm.getExpansionLoc(loc);
+            if (sm.isWrittenInMainFile(expansionLoc))
+            {
+                auto it = uses.expansions.find(sm.getFileOffset(expansionLoc));
+                if (it != uses.expansions.end())
+                {
+                    it->second.tokens += preproc.getSpelling(tok);
+                    it->second.tokens += ' ';
+                }
+            }
+        }
+        if (tok.is(tok::identifier) && !sm.isWrittenInMainFile(sm.getSpellingLoc(loc)))
+        {
+            uses.outside.insert(tok.getIdentifierInfo());
+        }
+        preproc.Lex(tok);
+    }
+
+    HygieneChecker checker(sm, uses);
+    StringRef filePath = sm.getFileEntryRefForID(sm.getMainFileID())->getName();
+    for (auto &[offset, expansion] : uses.expansions)
+    {
+        if (any_of(expansion.macros.begin(), expansion.macros.end(), [&](const MacroInfo *info)
+                   { return checker.isUnhygienic(info); }))
+        {
+            cantFail(r->add(Replacement(filePath, offset, expansion.end - offset, " " + expansion.tokens)));
+        }
+    }
+
+    // every use in code was just expanded
+    StringRef code = sm.getBufferData(sm.getMainFileID());
+    for (auto &[identifier, infos] : uses.defined)
+    {
+        for (const MacroInfo *info : infos)
+        {
+            if (checker.isUnhygienic(info) && !uses.needed.contains(info))
+            {
+                auto [begin, end] = wholeLines(code, sm.getFileOffset(info->getDefinitionLoc()), sm.getFileOffset(info->getDefinitionEndLoc()));
+                cantFail(r->add(Replacement(filePath, begin, end - begin, "")));
+            }
+        }
+    }
+}
+
 void process(SourceManager &sm, Preprocessor &preproc, Replacements *r)
 {
     // preparation
@@ -78,22 +444,33 @@ void process(SourceManager &sm, Preprocessor &preproc, Replacements *r)
 void ExpandMacroAction::ExecuteAction()
 {
     CompilerInstance &compiler = getCompilerInstance();
+    if (mode == ExpandMode::ConditionalsOnly)
+    {
+        stripConditionals(compiler.getSourceManager(), compiler.getPreprocessor(), replacements);
+        return;
+    }
+    if (mode == ExpandMode::Unhygienic)
+    {
+        expandUnhygienic(compiler.getSourceManager(), compiler.getPreprocessor(), replacements);
+        return;
+    }
     process(compiler.getSourceManager(), compiler.getPreprocessor(), replacements);
 }
-ExpandMacroAction::ExpandMacroAction(Replacements *replacements) : replacements(replacements) {}
-unique_ptr<FrontendActionFactory> ExpandMacroAction::newExpandMacroAction(Replacements *replacements)
+ExpandMacroAction::ExpandMacroAction(Replacements *replacements, ExpandMode mode) : replacements(replacements), mode(mode) {}
+unique_ptr<FrontendActionFactory> ExpandMacroAction::newExpandMacroAction(Replacements *replacements, ExpandMode mode)
 {
     class Adapter : public FrontendActionFactory
     {
     private:
         Replacements *replacements;
+        ExpandMode mode;
 
     public:
-        Adapter(Replacements *replacements) : replacements(replacements) {};
+        Adapter(Replacements *replacements, ExpandMode mode) : replacements(replacements), mode(mode) {};
         virtual unique_ptr<FrontendAction> create() override
         {
-            return make_unique<ExpandMacroAction>(replacements);
+            return make_unique<ExpandMacroAction>(replacements, mode);
         }
     };
-    return make_unique<Adapter>(replacements);
+    return make_unique<Adapter>(replacements, mode);
 }
\ No newline at end of file
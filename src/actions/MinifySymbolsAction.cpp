@@ -1,15 +1,24 @@
 #include <actions/MinifySymbolsAction.hpp>
+#include <util/parallel.hpp>
+#include <util/literals.hpp>
 #include <util/symbols.hpp>
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/TargetInfo.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Frontend/FrontendActions.h>
 #include <clang/Tooling/CommonOptionsParser.h>
 #include <clang/Rewrite/Core/Rewriter.h>
 #include <clang/Tooling/Tooling.h>
+#include <clang/Lex/MacroInfo.h>
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Lex/Lexer.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/Support/CommandLine.h>
 #include <fstream>
+#include <climits>
 #include <iostream>
 #include <vector>
 #include <sstream>
@@ -27,53 +36,324 @@ class StateManager
 private:
     // class that will deal with the state of the explorer,
     // ie the stack of scopes
-    // function adds symbol to scope, then pushes a new scope set to current scope's
-    //      maxUsedSymbol
-    // struct/union adds symbol to scope, then pushes a new scope set to 0
+    // function adds symbol to scope, then pushes a new scope that sees the current scope's symbols
+    // struct/union adds symbol to scope, then pushes a new empty scope
     // enum/typedefs/vars just add to the scope
     // canonical declaration
+    //
+    // names are handed out once the whole translation unit has been seen, so that
+    // the symbols referenced most often within a scope get the shortest names
+    //
+    // only main file code gets renamed, so scopes are tracked as offsets into the main file
     struct Scope
     {
-        SourceLocation end;
+        unsigned end; // main file offset, inclusive
+        int id;       // index into scopeInfos
+
+        Scope(unsigned end, int id) : end(end), id(id) {}
+    };
+    struct ScopeInfo
+    {
         struct ScopePair
         {
-            int maxUsedSymbol; // exclusive
-            set<string> externalSymbols;
-
-            ScopePair(int maxUsedSymbol = 0) : maxUsedSymbol(maxUsedSymbol) {};
+            vector<int> symbols; // declared directly in this scope, in order
+            int visibleParentSymbols = 0; // how many of the parent's symbols were declared when this scope was pushed
+            int base = 0;                 // first index into the SymbolTable this scope may use
         };
 
+        int parent;    // -1 for the global scope
+        bool inherits; // whether the parent's symbols are visible in here
         ScopePair declarations;
         ScopePair typeNames;
 
-        Scope(SourceLocation end) : end(end) {}
-        Scope(SourceLocation end, const Scope &other) : end(end),
-                                                        declarations(other.declarations.maxUsedSymbol),
-                                                        typeNames(other.typeNames.maxUsedSymbol) {};
+        ScopeInfo(int parent, bool inherits) : parent(parent), inherits(inherits) {}
+    };
+    struct Symbol
+    {
+        StringRef name;         // the original name
+        vector<unsigned> sites; // main file offset of every place the name is written
+        int index = 0;          // index into the SymbolTable, once assigned
+        bool kept = false;      // macros make it unsafe to rename, so it keeps its name
     };
 
     vector<Scope> scopes;          // pair of scope and when that scope ends
-    map<void *, int> typeNames;    // for enum/(struct/union) name rewrites
-    map<Decl *, int> declarations; // for variables and functions and typedefs
-    set<string> *definitions;      // for reserved macro-defined identifiers
+    vector<ScopeInfo> scopeInfos;  // every scope ever pushed, parents before children
+    vector<Symbol> symbols;        // every symbol that gets renamed
+    DenseMap<void *, int> typeNames;    // for enum/(struct/union) name rewrites
+    DenseMap<Decl *, int> declarations; // for variables and functions and typedefs
+    SymbolTable declSymbols;       // names for declarations, skipping globals that keep their name
+    SymbolTable typeSymbols;       // names for types, skipping globals that keep their name
+    vector<unsigned> pinnedSites;  // macro body offsets that also name something that isn't renamed
+    vector<pair<unsigned, unsigned>> stringizedRanges; // expansions of macros that stringize their arguments, inclusive
+    StringSet<> keptDeclNames;     // names of declarations that keep them
+    StringSet<> keptTypeNames;     // names of types that keep them
     int *firstUnusedSymbol;        // not owned by this class
     ASTContext *context;
+    FileID mainFileId;
 
-    void adjustScopes(SourceLocation cur)
+    // where the location ends up in the main file, if it does at all
+    optional<unsigned> mainFileOffset(SourceLocation location)
     {
-        // case where cur is in a different translation unit
-        // since locations might be in different files, we compare them
-        // with something more complicated than cur > scopes.back().end
-        while (context->getSourceManager().isBeforeInTranslationUnit(scopes.back().end, cur))
+        auto [fileId, offset] = context->getSourceManager().getDecomposedExpansionLoc(location);
+        if (fileId != mainFileId)
+        {
+            return nullopt;
+        }
+        return offset;
+    }
+
+    void adjustScopes(unsigned cur)
+    {
+        while (scopes.back().end < cur)
         {
             scopes.pop_back();
         }
     }
+    void adjustScopes(SourceLocation cur)
+    {
+        if (optional<unsigned> offset = mainFileOffset(cur))
+        {
+            adjustScopes(*offset);
+        }
+    }
+
+    // whether some global that keeps its name (from a header, say) is already called this.
+    // external symbols only really apply from global scope, and this only gets asked once
+    // a name is about to be handed out, so nothing from the headers is ever visited or copied
+    bool isTakenGlobally(StringRef name, bool isType)
+    {
+        if ((isType ? keptTypeNames : keptDeclNames).contains(name))
+        {
+            return true;
+        }
+        IdentifierTable &identifiers = context->Idents;
+        auto it = identifiers.find(name);
+        if (it == identifiers.end())
+        {
+            // nothing anywhere is spelled like this
+            return false;
+        }
+        for (NamedDecl *decl : context->getTranslationUnitDecl()->lookup(DeclarationName(it->getValue())))
+        {
+            if (isType && decl->isInIdentifierNamespace(Decl::IDNS_Tag) &&
+                !typeNames.count(QualType(cast<TypeDecl>(decl)->getTypeForDecl(), 0).getAsOpaquePtr()))
+            {
+                return true;
+            }
+            if (!isType && decl->isInIdentifierNamespace(Decl::IDNS_Ordinary) && !declarations.count(decl->getCanonicalDecl()))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // where a name is written, if that is somewhere in the main file. names that come
+    // from a header's macro or that were pasted together with ## are written nowhere in it
+    optional<unsigned> siteOffset(SourceLocation location)
+    {
+        auto [fileId, offset] = context->getSourceManager().getDecomposedSpellingLoc(location);
+        if (fileId != mainFileId)
+        {
+            return nullopt;
+        }
+        return offset;
+    }
+
+    void addSite(int symbolId, SourceLocation location)
+    {
+        if (optional<unsigned> site = siteOffset(location))
+        {
+            symbols[symbolId].sites.push_back(*site);
+        }
+        else
+        {
+            // can't rewrite a name that isn't written in the file
+            symbols[symbolId].kept = true;
+        }
+    }
+
+    // adds a symbol to the current scope, or returns the one the key already has
+    template <typename Key>
+    int addSymbol(DenseMap<Key, int> &known, Key key, ScopeInfo::ScopePair &scope, SourceLocation location, StringRef name)
+    {
+        auto [it, inserted] = known.try_emplace(key, symbols.size());
+        if (inserted)
+        {
+            symbols.push_back(Symbol{name, {}});
+            scope.symbols.push_back(it->second);
+        }
+        addSite(it->second, location);
+        return it->second;
+    }
+
+    // a reference to something that isn't renamed, which matters if a macro body wrote it
+    void addUnrenamedReference(SourceLocation location)
+    {
+        if (location.isMacroID())
+        {
+            if (optional<unsigned> site = siteOffset(location))
+            {
+                pinnedSites.push_back(*site);
+            }
+        }
+    }
+
+    // the main file offset of each place is only written once, so when a macro body
+    // is expanded where its names mean different things, one rewrite can't fit them all.
+    // the symbols involved keep their names, and nothing else may be given those names
+    void keepUnhygienicSymbols()
+    {
+        vector<pair<unsigned, int>> claims; // (site, symbol), -1 for something that isn't renamed
+        for (int symbolId = 0; symbolId < symbols.size(); ++symbolId)
+        {
+            for (unsigned site : symbols[symbolId].sites)
+            {
+                claims.push_back({site, symbolId});
+            }
+        }
+        for (unsigned site : pinnedSites)
+        {
+            claims.push_back({site, -1});
+        }
+        std::sort(claims.begin(), claims.end());
+        for (int i = 0, j = 0; i < claims.size(); i = j)
+        {
+            while (j < claims.size() && claims[j].first == claims[i].first)
+            {
+                ++j;
+            }
+            if (claims[i].second == claims[j - 1].second)
+            {
+                continue;
+            }
+            for (int k = i; k < j; ++k)
+            {
+                if (claims[k].second >= 0)
+                {
+                    symbols[claims[k].second].kept = true;
+                }
+            }
+        }
+
+        // renaming an argument of #x would change the string it makes
+        std::sort(stringizedRanges.begin(), stringizedRanges.end());
+        for (Symbol &symbol : symbols)
+        {
+            for (unsigned site : symbol.sites)
+            {
+                auto it = upper_bound(stringizedRanges.begin(), stringizedRanges.end(), make_pair(site, UINT_MAX));
+                if (it != stringizedRanges.begin() && prev(it)->second >= site)
+                {
+                    symbol.kept = true;
+                    break;
+                }
+            }
+        }
+
+        for (auto [pair, kept] : {make_pair(&ScopeInfo::declarations, &keptDeclNames), make_pair(&ScopeInfo::typeNames, &keptTypeNames)})
+        {
+            for (ScopeInfo &scope : scopeInfos)
+            {
+                for (int symbolId : (scope.*pair).symbols)
+                {
+                    if (symbols[symbolId].kept)
+                    {
+                        kept->insert(symbols[symbolId].name);
+                    }
+                }
+            }
+        }
+    }
+
+    void pushScope(SourceLocation endLocation, bool inherits)
+    {
+        unsigned end = mainFileOffset(endLocation).value_or(scopes.back().end);
+        adjustScopes(end);
+        int parent = scopes.back().id;
+        ScopeInfo info(parent, inherits);
+        info.declarations.visibleParentSymbols = scopeInfos[parent].declarations.symbols.size();
+        info.typeNames.visibleParentSymbols = scopeInfos[parent].typeNames.symbols.size();
+        scopes.push_back(Scope(end, scopeInfos.size()));
+        scopeInfos.push_back(info);
+    }
+
+    // gives the symbols of one scope indices starting at its base, most referenced first
+    void assignIndices(ScopeInfo::ScopePair &scope)
+    {
+        vector<int> ranked;
+        for (int symbolId : scope.symbols)
+        {
+            if (!symbols[symbolId].kept)
+            {
+                ranked.push_back(symbolId);
+            }
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [&](int a, int b)
+                    { return symbols[a].sites.size() > symbols[b].sites.size(); });
+        for (int rank = 0; rank < ranked.size(); ++rank)
+        {
+            symbols[ranked[rank]].index = scope.base + rank;
+        }
+    }
 
-    void adjustMaxUsedSymbol(Scope::ScopePair &scope, int nextSymbolNum)
+    // a child can't reuse any name visible from its parent when it was pushed
+    void inheritBase(ScopeInfo::ScopePair &child, const ScopeInfo::ScopePair &parent)
     {
-        scope.maxUsedSymbol = nextSymbolNum;
-        *firstUnusedSymbol = max(*firstUnusedSymbol, nextSymbolNum);
+        child.base = parent.base;
+        for (int i = 0; i < child.visibleParentSymbols; ++i)
+        {
+            const Symbol &symbol = symbols[parent.symbols[i]];
+            if (!symbol.kept)
+            {
+                child.base = max(child.base, symbol.index + 1);
+            }
+        }
+    }
+
+    // counts the places each symbol of a scope is written, then gives them indices.
+    // only touches this scope's symbols and reads its parent's, so it is safe
+    // to run on scopes under different top level declarations at once
+    void nameScope(ScopeInfo &scope)
+    {
+        for (ScopeInfo::ScopePair *pair : {&scope.declarations, &scope.typeNames})
+        {
+            // a name written inside a macro body shows up once per expansion, but is only written once
+            for (int symbolId : pair->symbols)
+            {
+                vector<unsigned> &sites = symbols[symbolId].sites;
+                std::sort(sites.begin(), sites.end());
+                sites.erase(std::unique(sites.begin(), sites.end()), sites.end());
+            }
+        }
+        if (scope.inherits)
+        {
+            inheritBase(scope.declarations, scopeInfos[scope.parent].declarations);
+            inheritBase(scope.typeNames, scopeInfos[scope.parent].typeNames);
+        }
+        assignIndices(scope.declarations);
+        assignIndices(scope.typeNames);
+    }
+
+    // the tables must already hold every index in use
+    void buildReplacements(const ScopeInfo &scope, StringRef filePath, vector<Replacement> &out)
+    {
+        for (auto [pair, table] : {make_pair(&scope.declarations, &declSymbols), make_pair(&scope.typeNames, &typeSymbols)})
+        {
+            for (int symbolId : pair->symbols)
+            {
+                const Symbol &symbol = symbols[symbolId];
+                if (symbol.kept)
+                {
+                    continue;
+                }
+                const string &name = symbolName(table->number(symbol.index));
+                for (unsigned site : symbol.sites)
+                {
+                    out.push_back(Replacement(filePath, site, symbol.name.size(), name));
+                }
+            }
+        }
     }
 
 public:
@@ -89,106 +369,93 @@ public:
      * When a declaration is added to the current scope, it is added to the
      * current scope's set of symbols.
      * The StateManager also keeps track of all of the symbols added to all of the
-     * scopes in the scope stack.
+     * scopes in the scope stack, along with every place they are written, and
+     * only decides on their names in `finish`.
      * @param context the ASTContext to use with this StateManager
      */
-    StateManager(set<string> *definitions, int *firstUnusedSymbol, ASTContext *context) : definitions(definitions), firstUnusedSymbol(firstUnusedSymbol), context(context)
+    StateManager(StringSet<> *definitions, int *firstUnusedSymbol, ASTContext *context) : declSymbols(definitions, [this](StringRef name)
+                                                                                                                   { return isTakenGlobally(name, false); }),
+                                                                                             typeSymbols(definitions, [this](StringRef name)
+                                                                                                         { return isTakenGlobally(name, true); }),
+                                                                                             firstUnusedSymbol(firstUnusedSymbol), context(context)
     {
         // start with a global scope
-        FileID mainFileId = context->getSourceManager().getMainFileID();
-        scopes.push_back(Scope(context->getSourceManager().getLocForEndOfFile(mainFileId)));
+        mainFileId = context->getSourceManager().getMainFileID();
+        scopes.push_back(Scope(context->getSourceManager().getBufferData(mainFileId).size(), 0));
+        scopeInfos.push_back(ScopeInfo(-1, false));
     };
     /**
      * @brief Adds a declaration (variable/function/typedef) to the current scope
      *
-     * @param decl the declaration. It should be a new declaration not already added with `addSymbol`.
-     *       If it already exists in the scope, then its existing symbol is replaced
-     * @return string
+     * @param decl the declaration. If it was already added (say, as a prototype),
+     *       its existing symbol is reused and this is just one more place to rename
      */
-    string addDecl(Decl *decl)
+    void addDecl(NamedDecl *decl)
     {
         // first, adjust scopes
         adjustScopes(decl->getLocation());
 
         // store it in declarations
-        Scope::ScopePair &relevant = scopes.back().declarations;
-        int symbolNum = relevant.maxUsedSymbol;
-        auto [nextSymbolNum, str] = toSymbol(symbolNum, scopes.front().declarations.externalSymbols, definitions); // external symbols only really apply from global scope
-        declarations[decl->getCanonicalDecl()] = symbolNum;
-        adjustMaxUsedSymbol(relevant, nextSymbolNum);
-        return str;
+        addSymbol(declarations, decl->getCanonicalDecl(), scopeInfos[scopes.back().id].declarations, decl->getLocation(), decl->getName());
     }
     /**
      * @brief Adds a type (struct name or enum name) to the current scope
      *
      * @param location the type's location (used to adjust scopes)
      * @param tp the type to add
-     * @return string
+     * @param name the type's name
      */
-    string addType(SourceLocation location, QualType tp)
+    void addType(SourceLocation location, QualType tp, StringRef name)
     {
         // first, adjust scopes
         adjustScopes(location);
 
         // store it in declarations
-        Scope::ScopePair &relevant = scopes.back().typeNames;
-        int symbolNum = relevant.maxUsedSymbol;
-        auto [nextSymbolNum, str] = toSymbol(symbolNum, scopes.front().typeNames.externalSymbols, definitions); // external symbols only really apply from global scope
-        typeNames[tp.getAsOpaquePtr()] = symbolNum;
-        adjustMaxUsedSymbol(relevant, nextSymbolNum);
-        return str;
+        addSymbol(typeNames, tp.getAsOpaquePtr(), scopeInfos[scopes.back().id].typeNames, location, name);
     }
     /**
-     * @brief Adds a symbol that cannot be rewritten to the current scope's declarations
+     * @brief Records a reference to the given declaration
      *
-     * @param decl the declaration that cannot be rewritten
-     * @param symbol the declaration's name
+     * @param decl the referenced declaration
+     * @param location where its name is written, which may be inside a macro
      */
-    void addExternalDecl(Decl *decl, string symbol)
+    void addDeclReference(Decl *decl, SourceLocation location)
     {
-        // first, adjust scopes
-        adjustScopes(decl->getLocation());
-
-        // then, add the symbol
-        scopes.back().declarations.externalSymbols.emplace(symbol);
+        auto it = declarations.find(decl->getCanonicalDecl());
+        if (it != declarations.end())
+        {
+            addSite(it->second, location);
+        }
+        else
+        {
+            addUnrenamedReference(location);
+        }
     }
-    /**
-     * @brief Adds a symbol that cannot be rewritten to the current scope's types
-     *
-     * @param location the location of the type (for adjusting the scope)
-     * @param symbol the type's name
-     */
-    void addExternalType(SourceLocation location, string symbol)
+    void addTypeReference(QualType tp, SourceLocation location)
     {
-        // first, adjust scopes
-        adjustScopes(location);
-
-        // then, add the symbol
-        scopes.back().typeNames.externalSymbols.emplace(symbol);
+        auto it = typeNames.find(tp.getAsOpaquePtr());
+        if (it != typeNames.end())
+        {
+            addSite(it->second, location);
+        }
+        else
+        {
+            addUnrenamedReference(location);
+        }
     }
     /**
-     * @brief Get the abbreviated symbol for the given declaration, or fall
-     * back to original
+     * @brief Records where a macro that stringizes its arguments was expanded
      *
-     * @param decl
-     * @return string
+     * @param range the expansion, from the macro's name to its closing parenthesis
      */
-    optional<string> getDeclAbbr(Decl *decl)
+    void addStringizingExpansion(SourceRange range)
     {
-        if (declarations.find(decl->getCanonicalDecl()) == declarations.end())
+        optional<unsigned> begin = mainFileOffset(range.getBegin());
+        optional<unsigned> end = mainFileOffset(range.getEnd());
+        if (begin && end)
         {
-            return optional<string>();
+            stringizedRanges.push_back({*begin, *end});
         }
-        // external symbols only really apply from global scope
-        return toSymbol(declarations[decl->getCanonicalDecl()], scopes.front().declarations.externalSymbols, definitions).second;
-    }
-    optional<string> getTypeAbbr(QualType tp)
-    {
-        if (typeNames.find(tp.getAsOpaquePtr()) == typeNames.end())
-        {
-            return optional<string>();
-        }
-        return toSymbol(typeNames[tp.getAsOpaquePtr()], scopes.front().typeNames.externalSymbols, definitions).second;
     }
 
     // enums
@@ -199,26 +466,147 @@ public:
      * @param end the source location, inclusive, of when the scope should end
      *
      * @details This method adds a scope that will be completely empty, meaning that symbols will start again
-     * from 0, no matter what the current scope's maxSymbol is presently
+     * from 0, no matter what the current scope holds presently
      *
      */
     void pushEmptyScope(SourceLocation end)
     {
-        adjustScopes(end);
-        scopes.push_back(Scope(end));
+        pushScope(end, false);
     }
     /**
-     * @brief Push a scope identical to the current scope onto the scope stack
+     * @brief Push a scope that sees the current scope onto the scope stack
      *
      * @end the source location, inclusive, of when the scope should end
      *
-     * @details This method adds a scope that has the same maxSymbol as the current scope
+     * @details Symbols in the new scope never share a name with a symbol visible from the current scope
      *
      */
     void pushCurScope(SourceLocation end)
     {
-        adjustScopes(end);
-        scopes.push_back(Scope(end, scopes.back()));
+        pushScope(end, true);
+    }
+
+    /**
+     * @brief Names every symbol and adds the rewrites of all the places it's written
+     *
+     * Symbols that macros make unsafe to rename keep their names. The global scope
+     * is named next. Every other scope only depends on it, so the
+     * scopes under each top level declaration are named and turned into replacements
+     * on their own thread, then merged in order so the output doesn't depend on timing.
+     *
+     * @param replacements out
+     * @param jobs the maximum number of threads, 0 for one per hardware thread
+     */
+    void finish(Replacements *replacements, int jobs)
+    {
+        // scopes are numbered in traversal order, so the ones under a top level
+        // declaration are consecutive and come right after it
+        vector<pair<int, int>> units; // [first, last) scope ids
+        for (int id = 1; id < scopeInfos.size(); ++id)
+        {
+            int parent = scopeInfos[id].parent;
+            if (parent == 0)
+            {
+                units.push_back({id, id + 1});
+                continue;
+            }
+            // a scope whose parent is in an earlier unit ties those units together
+            while (units.back().first > parent)
+            {
+                int last = units.back().second;
+                units.pop_back();
+                units.back().second = last;
+            }
+            units.back().second = id + 1;
+        }
+
+        keepUnhygienicSymbols();
+        nameScope(scopeInfos[0]);
+        parallelFor(units.size(), jobs, [&](int u)
+                    {
+                        for (int id = units[u].first; id < units[u].second; ++id)
+                        {
+                            nameScope(scopeInfos[id]);
+                        } });
+
+        // the tables look names up in the AST as they grow, so grow them up front
+        int maxDeclIndex = -1, maxTypeIndex = -1;
+        for (ScopeInfo &scope : scopeInfos)
+        {
+            for (int symbolId : scope.declarations.symbols)
+            {
+                if (!symbols[symbolId].kept)
+                {
+                    maxDeclIndex = max(maxDeclIndex, symbols[symbolId].index);
+                }
+            }
+            for (int symbolId : scope.typeNames.symbols)
+            {
+                if (!symbols[symbolId].kept)
+                {
+                    maxTypeIndex = max(maxTypeIndex, symbols[symbolId].index);
+                }
+            }
+        }
+        declSymbols.number(maxDeclIndex);
+        typeSymbols.number(maxTypeIndex);
+
+        // build every unit's rewrites on its own, then add them in order
+        StringRef filePath = context->getSourceManager().getFileEntryRefForID(mainFileId)->getName();
+        vector<vector<Replacement>> unitReplacements(units.size() + 1);
+        buildReplacements(scopeInfos[0], filePath, unitReplacements[0]);
+        parallelFor(units.size(), jobs, [&](int u)
+                    {
+                        for (int id = units[u].first; id < units[u].second; ++id)
+                        {
+                            buildReplacements(scopeInfos[id], filePath, unitReplacements[u + 1]);
+                        } });
+        for (vector<Replacement> &unit : unitReplacements)
+        {
+            for (Replacement &replacement : unit)
+            {
+                cantFail(replacements->add(replacement));
+            }
+        }
+        *firstUnusedSymbol = max({*firstUnusedSymbol, maxDeclIndex < 0 ? 0 : declSymbols.number(maxDeclIndex) + 1, maxTypeIndex < 0 ? 0 : typeSymbols.number(maxTypeIndex) + 1});
+
+        // the defines added later must not take a name that was kept either
+        for (StringSet<> *kept : {&keptDeclNames, &keptTypeNames})
+        {
+            for (const auto &entry : *kept)
+            {
+                *firstUnusedSymbol = max(*firstUnusedSymbol, symbolNumber(entry.getKey()) + 1);
+            }
+        }
+    }
+};
+
+// remembers where macros that stringize their arguments are expanded, since the
+// names passed to them end up in a string literal as well as in the code
+class MacroHygieneCallbacks : public PPCallbacks
+{
+private:
+    SourceManager &sm;
+    StateManager &manager;
+
+public:
+    MacroHygieneCallbacks(SourceManager &sm, StateManager &manager) : sm(sm), manager(manager) {}
+    virtual void MacroExpands(const Token &macroNameTok, const MacroDefinition &definition, SourceRange range, const MacroArgs *args) override
+    {
+        const MacroInfo *info = definition.getMacroInfo();
+        if (args == nullptr || info == nullptr)
+        {
+            return;
+        }
+        for (const Token &tok : info->tokens())
+        {
+            if (tok.isOneOf(tok::hash, tok::hashat))
+            {
+                // arguments may come from an enclosing expansion, so cover all of it
+                manager.addStringizingExpansion(sm.getExpansionRange(range).getAsRange());
+                return;
+            }
+        }
     }
 };
 
@@ -234,12 +622,54 @@ class MinifierVisitor
 private:
     Replacements *replacements;
     ASTContext *context;
-    string sourceFileName;
+    FileID mainFileId;
+    MinifySymbolsOptions options;
     StateManager manager;
+    DenseSet<unsigned> shortenedLiterals; // main file offsets of literals already handled, since some are visited twice
+
+    // rewrites a literal written in the main file, if the new spelling is shorter
+    void shortenLiteral(SourceLocation loc, const string &spelling)
+    {
+        SourceManager &sm = context->getSourceManager();
+        if (spelling.empty() || !loc.isFileID() || !sm.isInMainFile(loc))
+        {
+            return;
+        }
+        unsigned length = Lexer::MeasureTokenLength(loc, sm, context->getLangOpts());
+        unsigned offset = sm.getFileOffset(loc);
+        if (spelling.size() >= length || !shortenedLiterals.insert(offset).second)
+        {
+            return;
+        }
+        StringRef filePath = sm.getFileEntryRefForID(mainFileId)->getName();
+        cantFail(replacements->add(Replacement(filePath, offset, length, spelling)));
+    }
+
+    // keeps the spelling of a literal that's only part of its token, like the 2 of 2i or the 10 of 10_km
+    void keepLiteral(const Expr *literal)
+    {
+        SourceManager &sm = context->getSourceManager();
+        SourceLocation loc = literal->getBeginLoc();
+        if (loc.isFileID() && sm.isInMainFile(loc))
+        {
+            shortenedLiterals.insert(sm.getFileOffset(loc));
+        }
+    }
 
 public:
-    explicit MinifierVisitor(set<string> *definitions, Replacements *r, int *firstUnusedSymbol, ASTContext *context, string sourceFileName)
-        : replacements(r), context(context), sourceFileName(sourceFileName), manager(definitions, firstUnusedSymbol, context) {}
+    explicit MinifierVisitor(StringSet<> *definitions, Replacements *r, int *firstUnusedSymbol, ASTContext *context, MinifySymbolsOptions options)
+        : replacements(r), context(context), mainFileId(context->getSourceManager().getMainFileID()), options(options), manager(definitions, firstUnusedSymbol, context) {}
+
+    StateManager &getManager()
+    {
+        return manager;
+    }
+
+    // names every symbol seen during the traversal
+    void finish()
+    {
+        manager.finish(replacements, options.jobs);
+    }
 
     template <typename T>
     pair<SourceLocation, bool> getLoc(T *decl)
@@ -248,7 +678,7 @@ public:
         SourceLocation begin = decl->getBeginLoc();
         SourceLocation spellingLoc = m.getSpellingLoc(begin);
         if (spellingLoc.isValid() &&
-            m.getFilename(spellingLoc) == sourceFileName)
+            m.getFileID(spellingLoc) == mainFileId)
         {
             return {spellingLoc, true};
         }
@@ -262,14 +692,8 @@ public:
         {
             // register it and replace it
             QualType tp(decl->getTypeForDecl(), 0);
-            string replacement = manager.addType(decl->getLocation(), tp);
-            cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), replacement)));
-        }
-        else
-        {
-            // external enum type name, maybe it affects us, maybe not; either way, register it
-            manager.addExternalType(decl->getLocation(), decl->getNameAsString());
-        }
+            manager.addType(decl->getLocation(), tp, decl->getName());
+        } // can't rewrite code outside of file
         return true;
     }
     bool VisitEnumConstantDecl(EnumConstantDecl *decl)
@@ -279,13 +703,8 @@ public:
         {
             // need to add this to known declarations
             // and then also replace this
-            cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), manager.addDecl(decl))));
-        }
-        else
-        {
-            // external variable, maybe it affects us, maybe not
-            manager.addExternalDecl(decl, decl->getNameAsString());
-        }
+            manager.addDecl(decl);
+        } // can't rewrite code outside of file
         return true;
     }
 
@@ -297,17 +716,11 @@ public:
         {
             // rewrite record name
             QualType tp(decl->getTypeForDecl(), 0);
-            string replacement = manager.addType(decl->getLocation(), tp);
-            cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), replacement)));
+            manager.addType(decl->getLocation(), tp, decl->getName());
 
             // push a new scope since the struct is its own scope
             manager.pushEmptyScope(decl->getEndLoc());
-        }
-        else
-        {
-            // external type that may/may not affects us
-            manager.addExternalType(decl->getLocation(), decl->getNameAsString());
-        }
+        } // can't rewrite code outside of file
         return true;
     }
     // struct members
@@ -316,7 +729,7 @@ public:
         pair<SourceLocation, bool> p = getLoc(decl);
         if (p.second)
         {
-            cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), manager.addDecl(decl))));
+            manager.addDecl(decl);
         } // can't rewrite code outside of file
         return true;
     }
@@ -328,13 +741,8 @@ public:
         if (p.second)
         {
             // add symbol and rewrite it
-            cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), manager.addDecl(decl))));
-        }
-        else
-        {
-            // add external typedef to known symbols
-            manager.addExternalDecl(decl, decl->getNameAsString());
-        }
+            manager.addDecl(decl);
+        } // can't rewrite code outside of file
         return true;
     }
 
@@ -357,21 +765,14 @@ public:
         if (p.second)
         {
             // do replacement first (since function needs to be visible to following items)
-            if (decl->getNameAsString() != "main")
+            if (!decl->isMain())
             {
                 // then rewrite this function too
-                cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), manager.addDecl(decl))));
+                manager.addDecl(decl);
             }
             // then push a new scope based on current scope
             manager.pushCurScope(decl->getEndLoc());
-        }
-        else
-        {
-            // external, maybe it affects us, maybe not
-            manager.addExternalDecl(decl, decl->getNameAsString());
-            // and also push a new scope
-            manager.pushCurScope(decl->getEndLoc());
-        }
+        } // can't rewrite code outside of file
         return true;
     }
 
@@ -381,64 +782,127 @@ public:
         pair<SourceLocation, bool> p = getLoc(decl);
         if (p.second)
         {
-            cantFail(replacements->add(Replacement(context->getSourceManager(), decl->getLocation(), decl->getNameAsString().size(), manager.addDecl(decl))));
-        }
-        else
-        {
-            // external, but might be an accessible global variable
-            // so add it as an external symbol
-            manager.addExternalDecl(decl, decl->getNameAsString());
-        }
+            manager.addDecl(decl);
+        } // can't rewrite code outside of file
         return true;
     }
 
+    // references are always recorded, even when a header's macro wrote them,
+    // so that what they refer to keeps its name if they can't be rewritten
+
     // reference to variable
     bool VisitDeclRefExpr(DeclRefExpr *expr)
     {
-        pair<SourceLocation, bool> p = getLoc(expr);
-        if (p.second)
-        {
-            string originalName = expr->getDecl()->getNameAsString();
-            if (optional<string> replacement = manager.getDeclAbbr(expr->getDecl()))
-            {
-                cantFail(replacements->add(Replacement(context->getSourceManager(), p.first, originalName.size(), *replacement)));
-            }
-        } // can't rewrite code outside of file
+        manager.addDeclReference(expr->getDecl(), expr->getLocation());
         return true;
     }
     // reference to member variable
     bool VisitMemberExpr(MemberExpr *expr)
     {
-        pair<SourceLocation, bool> p = getLoc(expr);
-        if (p.second)
+        manager.addDeclReference(expr->getMemberDecl(), expr->getExprLoc());
+        return true;
+    }
+
+    // literals, written with the shortest spelling that keeps their type and value.
+    // these are visited before the literals in them, which would lose their suffix
+    bool VisitImaginaryLiteral(ImaginaryLiteral *literal)
+    {
+        keepLiteral(literal->getSubExpr());
+        return true;
+    }
+    bool VisitUserDefinedLiteral(UserDefinedLiteral *literal)
+    {
+        for (const Expr *argument : literal->arguments())
         {
-            string originalName = expr->getMemberDecl()->getNameAsString();
-            if (optional<string> replacement = manager.getDeclAbbr(expr->getMemberDecl()))
-            {
-                cantFail(replacements->add(Replacement(context->getSourceManager(), expr->getExprLoc(), originalName.size(), *replacement)));
-            }
-        } // can't rewrite code outside of file
+            keepLiteral(argument);
+        }
+        return true;
+    }
+    bool VisitIntegerLiteral(IntegerLiteral *literal)
+    {
+        if (!options.shortenLiterals || literal->getValue().getActiveBits() > 64)
+        {
+            return true;
+        }
+        const BuiltinType *type = literal->getType().getCanonicalType()->getAs<BuiltinType>();
+        if (type == nullptr)
+        {
+            return true;
+        }
+        IntegerType integerType;
+        switch (type->getKind())
+        {
+        case BuiltinType::Int:
+            integerType = IntegerType::Int;
+            break;
+        case BuiltinType::UInt:
+            integerType = IntegerType::UnsignedInt;
+            break;
+        case BuiltinType::Long:
+            integerType = IntegerType::Long;
+            break;
+        case BuiltinType::ULong:
+            integerType = IntegerType::UnsignedLong;
+            break;
+        case BuiltinType::LongLong:
+            integerType = IntegerType::LongLong;
+            break;
+        case BuiltinType::ULongLong:
+            integerType = IntegerType::UnsignedLongLong;
+            break;
+        default:
+            // 128 bit and bit-precise literals keep their spelling
+            return true;
+        }
+        const TargetInfo &target = context->getTargetInfo();
+        IntegerWidths widths{target.getIntWidth(), target.getLongWidth(), target.getLongLongWidth()};
+        shortenLiteral(literal->getLocation(), shortestIntegerLiteral(literal->getValue().getZExtValue(), integerType, widths));
+        return true;
+    }
+    bool VisitCharacterLiteral(CharacterLiteral *literal)
+    {
+        // wide and unicode literals keep their spelling
+        if (options.shortenLiterals && literal->getKind() == CharacterLiteral::Ascii)
+        {
+            // in C, but not C++, a character literal is an int
+            shortenLiteral(literal->getLocation(), shortestCharacterLiteral(literal->getValue(), !context->getLangOpts().CPlusPlus));
+        }
+        return true;
+    }
+    bool VisitFloatingLiteral(FloatingLiteral *literal)
+    {
+        if (!options.shortenLiterals)
+        {
+            return true;
+        }
+        QualType type = literal->getType().getCanonicalType();
+        string suffix;
+        if (type->isSpecificBuiltinType(BuiltinType::Float))
+        {
+            suffix = "f";
+        }
+        else if (type->isSpecificBuiltinType(BuiltinType::LongDouble))
+        {
+            suffix = "l";
+        }
+        else if (!type->isSpecificBuiltinType(BuiltinType::Double))
+        {
+            return true;
+        }
+        shortenLiteral(literal->getLocation(), shortestFloatingLiteral(literal->getValue(), suffix));
         return true;
     }
 
     // reference to member variable inside an initializer
     bool VisitDesignatedInitExpr(DesignatedInitExpr *expr)
     {
-        auto p = getLoc(expr);
-        if (p.second)
+        for (DesignatedInitExpr::Designator &d : expr->designators())
         {
-            for (DesignatedInitExpr::Designator &d : expr->designators())
+            if (d.isFieldDesignator())
             {
-                if (d.isFieldDesignator())
-                {
-                    StringRef originalName = d.getFieldName()->getName();
-                    if (optional<string> replacement = manager.getDeclAbbr(d.getFieldDecl()))
-                    {
-                        cantFail(replacements->add(Replacement(context->getSourceManager(), d.getFieldLoc(), originalName.size(), *replacement)));
-                    }
-                }
+                manager.addDeclReference(d.getFieldDecl(), d.getFieldLoc());
             }
-        } // can't rewrite code outside of file
+        }
         return true;
     }
 
@@ -447,12 +911,8 @@ public:
     {
         if (context->getSourceManager().isInMainFile(loc.getBeginLoc()))
         {
-            string name = loc.getDecl()->getNameAsString();
             // try replacement
-            if (optional<string> replacement = manager.getTypeAbbr(loc.getType()))
-            {
-                cantFail(replacements->add(Replacement(context->getSourceManager(), loc.getBeginLoc(), name.size(), *replacement)));
-            }
+            manager.addTypeReference(loc.getType(), loc.getBeginLoc());
         }
         return true;
     }
@@ -462,12 +922,8 @@ public:
     {
         if (context->getSourceManager().isInMainFile(loc.getBeginLoc()))
         {
-            string name = loc.getDecl()->getNameAsString();
             // try replacement
-            if (optional<string> replacement = manager.getTypeAbbr(loc.getType()))
-            {
-                cantFail(replacements->add(Replacement(context->getSourceManager(), loc.getBeginLoc(), name.size(), *replacement)));
-            }
+            manager.addTypeReference(loc.getType(), loc.getBeginLoc());
         }
         return true;
     }
@@ -477,54 +933,293 @@ public:
     {
         if (context->getSourceManager().isInMainFile(loc.getBeginLoc()))
         {
-            string name = loc.getTypedefNameDecl()->getNameAsString();
             // try replacement
-            if (optional<string> replacement = manager.getDeclAbbr(loc.getTypedefNameDecl()))
+            manager.addDeclReference(loc.getTypedefNameDecl(), loc.getBeginLoc());
+        }
+        return true;
+    }
+};
+
+// finds the top level declarations that nothing else needs. declarations are grouped the way
+// they were written (`struct s {...} a, b;` is one group), and a group can only go as a whole,
+// when everything in it is a static function or variable, a struct/union/enum, or a typedef.
+// the rest are what the program needs, and anything they use, directly or not, stays
+class UnusedDeclarations
+{
+private:
+    struct Group
+    {
+        unsigned begin;          // main file offset
+        unsigned end;            // main file offset, one past the last character
+        SourceLocation lastToken;
+        bool removable = true;
+        vector<Decl *> uses;     // everything referenced from inside the group
+    };
+
+    // what a top level declaration references
+    class UseCollector : public RecursiveASTVisitor<UseCollector>
+    {
+    private:
+        vector<Decl *> &uses;
+
+    public:
+        UseCollector(vector<Decl *> &uses) : uses(uses) {}
+        bool VisitDeclRefExpr(DeclRefExpr *expr)
+        {
+            uses.push_back(expr->getDecl());
+            return true;
+        }
+        bool VisitMemberExpr(MemberExpr *expr)
+        {
+            uses.push_back(expr->getMemberDecl());
+            return true;
+        }
+        bool VisitEnumTypeLoc(EnumTypeLoc loc)
+        {
+            uses.push_back(loc.getDecl());
+            return true;
+        }
+        bool VisitRecordTypeLoc(RecordTypeLoc loc)
+        {
+            uses.push_back(loc.getDecl());
+            return true;
+        }
+        bool VisitTypedefTypeLoc(TypedefTypeLoc loc)
+        {
+            uses.push_back(loc.getTypedefNameDecl());
+            return true;
+        }
+    };
+
+    ASTContext *context;
+    vector<Group> groups;
+    vector<int> groupOf;  // the group of each top level declaration, in order
+    DenseMap<Decl *, vector<int>> declaringGroups; // canonical top level declaration to every group that declares it
+
+    static bool isRemovable(Decl *decl)
+    {
+        if (decl->hasAttrs())
+        {
+            // used, constructor, section, ... all mean something needs it
+            return false;
+        }
+        if (FunctionDecl *function = dyn_cast<FunctionDecl>(decl))
+        {
+            return function->getStorageClass() == SC_Static;
+        }
+        if (VarDecl *var = dyn_cast<VarDecl>(decl))
+        {
+            return var->getStorageClass() == SC_Static;
+        }
+        return isa<TagDecl>(decl) || isa<TypedefDecl>(decl);
+    }
+
+    // the declaration directly in the translation unit that holds this one
+    static Decl *topLevel(Decl *decl)
+    {
+        DeclContext *parent = decl->getLexicalDeclContext();
+        while (parent != nullptr && !parent->isTranslationUnit())
+        {
+            decl = Decl::castFromDeclContext(parent);
+            parent = decl->getLexicalDeclContext();
+        }
+        return decl;
+    }
+
+    // deleting a directive along with the code around it would change what follows
+    bool containsDirective(unsigned begin, unsigned end)
+    {
+        StringRef code = context->getSourceManager().getBufferData(context->getSourceManager().getMainFileID()).slice(begin, end);
+        for (size_t line = code.find('\n'); line != StringRef::npos; line = code.find('\n', line + 1))
+        {
+            StringRef rest = code.drop_front(line + 1).ltrim(" \t");
+            if (!rest.empty() && rest.front() == '#')
             {
-                cantFail(replacements->add(Replacement(context->getSourceManager(), loc.getBeginLoc(), name.size(), *replacement)));
+                return true;
             }
         }
-        return true;
+        return false;
+    }
+
+    void addDecl(Decl *decl)
+    {
+        SourceManager &sm = context->getSourceManager();
+        SourceLocation begin = decl->getBeginLoc();
+        SourceLocation last = decl->getEndLoc();
+        bool inFile = begin.isFileID() && last.isFileID() && sm.isInMainFile(begin) && sm.isInMainFile(last);
+        unsigned beginOffset = inFile ? sm.getFileOffset(begin) : 0;
+        unsigned endOffset = inFile ? sm.getFileOffset(Lexer::getLocForEndOfToken(last, 0, sm, context->getLangOpts())) : 0;
+
+        // declarations written together overlap, like a struct defined inside a variable's declaration
+        if (!inFile || groups.empty() || beginOffset >= groups.back().end)
+        {
+            groups.push_back(Group{beginOffset, endOffset, last});
+        }
+        Group &group = groups.back();
+        if (endOffset > group.end)
+        {
+            group.end = endOffset;
+            group.lastToken = last;
+        }
+        group.removable = group.removable && inFile && isRemovable(decl);
+        groupOf.push_back(groups.size() - 1);
+        declaringGroups[decl->getCanonicalDecl()].push_back(groups.size() - 1);
+        UseCollector(group.uses).TraverseDecl(decl);
+    }
+
+public:
+    UnusedDeclarations(ASTContext *context) : context(context) {}
+
+    /**
+     * @brief Finds the top level declarations of the main file that nothing needs
+     *
+     * @param decls the main file's top level declarations, in order
+     * @param replacements out, the deletions of the unused ones
+     * @return DenseSet<Decl *> the declarations that were deleted
+     */
+    DenseSet<Decl *> remove(const vector<Decl *> &decls, Replacements *replacements)
+    {
+        for (Decl *decl : decls)
+        {
+            addDecl(decl);
+        }
+
+        // everything that can't be removed is needed, and so is everything it uses
+        vector<bool> needed(groups.size(), false);
+        vector<int> queue;
+        for (int g = 0; g < groups.size(); ++g)
+        {
+            if (!groups[g].removable || containsDirective(groups[g].begin, groups[g].end))
+            {
+                needed[g] = true;
+                queue.push_back(g);
+            }
+        }
+        while (!queue.empty())
+        {
+            int g = queue.back();
+            queue.pop_back();
+            for (Decl *use : groups[g].uses)
+            {
+                auto it = declaringGroups.find(topLevel(use)->getCanonicalDecl());
+                if (it == declaringGroups.end())
+                {
+                    // declared in a header
+                    continue;
+                }
+                for (int other : it->second)
+                {
+                    if (!needed[other])
+                    {
+                        needed[other] = true;
+                        queue.push_back(other);
+                    }
+                }
+            }
+        }
+
+        SourceManager &sm = context->getSourceManager();
+        StringRef filePath = sm.getFileEntryRefForID(sm.getMainFileID())->getName();
+        for (int g = 0; g < groups.size(); ++g)
+        {
+            if (needed[g])
+            {
+                continue;
+            }
+            // take the semicolon that ends the declaration with it
+            unsigned end = groups[g].end;
+            SourceLocation afterSemi = Lexer::findLocationAfterToken(groups[g].lastToken, tok::semi, sm, context->getLangOpts(), false);
+            if (afterSemi.isValid())
+            {
+                end = sm.getFileOffset(afterSemi);
+            }
+            cantFail(replacements->add(Replacement(filePath, groups[g].begin, end - groups[g].begin, "")));
+        }
+
+        DenseSet<Decl *> removed;
+        for (int i = 0; i < decls.size(); ++i)
+        {
+            if (!needed[groupOf[i]])
+            {
+                removed.insert(decls[i]);
+            }
+        }
+        return removed;
     }
 };
 
 class MinifierConsumer : public clang::ASTConsumer
 {
 private:
+    Replacements *replacements;
+    MinifySymbolsOptions options;
     MinifierVisitor visitor;
 
 public:
-    explicit MinifierConsumer(set<string> *definitions, Replacements *r, int *firstUnusedSymbol, ASTContext *context, string sourceFileName)
-        : visitor(definitions, r, firstUnusedSymbol, context, sourceFileName) {}
+    explicit MinifierConsumer(StringSet<> *definitions, Replacements *r, int *firstUnusedSymbol, ASTContext *context, MinifySymbolsOptions options)
+        : replacements(r), options(options), visitor(definitions, r, firstUnusedSymbol, context, options) {}
+
+    StateManager &getManager()
+    {
+        return visitor.getManager();
+    }
 
     virtual void HandleTranslationUnit(clang::ASTContext &context) override
     {
-        visitor.TraverseDecl(context.getTranslationUnitDecl());
+        // only main file code gets renamed, so skip everything the headers declare.
+        // names they take are looked up as needed when handing out names. in preprocessed
+        // input, the line markers say which parts of the main file came from headers
+        SourceManager &sm = context.getSourceManager();
+        vector<Decl *> decls;
+        for (Decl *decl : context.getTranslationUnitDecl()->decls())
+        {
+            if (sm.isInMainFile(sm.getExpansionLoc(decl->getLocation())))
+            {
+                decls.push_back(decl);
+            }
+        }
+
+        // what gets deleted doesn't need names
+        DenseSet<Decl *> removed;
+        if (options.removeUnused)
+        {
+            removed = UnusedDeclarations(&context).remove(decls, replacements);
+        }
+        for (Decl *decl : decls)
+        {
+            if (!removed.contains(decl))
+            {
+                visitor.TraverseDecl(decl);
+            }
+        }
+        visitor.finish();
     }
 };
-MinifySymbolsAction::MinifySymbolsAction(Replacements *replacements, set<string> *definitions, int *firstUnusedSymbol) : replacements(replacements), definitions(definitions), firstUnusedSymbol(firstUnusedSymbol) {};
+MinifySymbolsAction::MinifySymbolsAction(Replacements *replacements, StringSet<> *definitions, int *firstUnusedSymbol, MinifySymbolsOptions options) : replacements(replacements), definitions(definitions), firstUnusedSymbol(firstUnusedSymbol), options(options) {};
 std::unique_ptr<clang::ASTConsumer>
 MinifySymbolsAction::CreateASTConsumer(clang::CompilerInstance &compiler,
                                        llvm::StringRef inFile)
 {
-    return std::make_unique<MinifierConsumer>(
-        definitions, replacements, firstUnusedSymbol, &compiler.getASTContext(),
-        inFile.str());
+    unique_ptr<MinifierConsumer> consumer = std::make_unique<MinifierConsumer>(
+        definitions, replacements, firstUnusedSymbol, &compiler.getASTContext(), options);
+    compiler.getPreprocessor().addPPCallbacks(make_unique<MacroHygieneCallbacks>(compiler.getSourceManager(), consumer->getManager()));
+    return consumer;
 }
 
-std::unique_ptr<clang::tooling::FrontendActionFactory> MinifySymbolsAction::newMinifierAction(clang::tooling::Replacements *replacements, set<string> *definitions, int *firstUnusedSymbol)
+std::unique_ptr<clang::tooling::FrontendActionFactory> MinifySymbolsAction::newMinifierAction(clang::tooling::Replacements *replacements, StringSet<> *definitions, int *firstUnusedSymbol, MinifySymbolsOptions options)
 {
     class MinifierActionFactory : public FrontendActionFactory
     {
     public:
         Replacements *replacements;
-        set<string> *definitions;
+        StringSet<> *definitions;
         int *firstUnusedSymbol;
-        MinifierActionFactory(Replacements *rs, set<string> *definitions, int *firstUnusedSymbol) : replacements(rs), definitions(definitions), firstUnusedSymbol(firstUnusedSymbol) {};
+        MinifySymbolsOptions options;
+        MinifierActionFactory(Replacements *rs, StringSet<> *definitions, int *firstUnusedSymbol, MinifySymbolsOptions options) : replacements(rs), definitions(definitions), firstUnusedSymbol(firstUnusedSymbol), options(options) {};
         std::unique_ptr<FrontendAction> create() override
         {
-            return std::make_unique<MinifySymbolsAction>(replacements, definitions, firstUnusedSymbol);
+            return std::make_unique<MinifySymbolsAction>(replacements, definitions, firstUnusedSymbol, options);
         }
     };
-    return std::make_unique<MinifierActionFactory>(replacements, definitions, firstUnusedSymbol);
+    return std::make_unique<MinifierActionFactory>(replacements, definitions, firstUnusedSymbol, options);
 }
@@ -1,43 +1,366 @@
 #include <actions/PPSymbolsAction.hpp>
+#include <clang/Basic/CharInfo.h>
 #include <clang/Frontend/CompilerInstance.h>
+#include <clang/Lex/HeaderSearch.h>
+#include <clang/Lex/HeaderSearchOptions.h>
+#include <clang/Lex/DependencyDirectivesScanner.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Lex/MacroInfo.h>
+#include <clang/Lex/PreprocessorOptions.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/xxhash.h>
 using namespace clang;
+using namespace llvm;
 using namespace std;
 using namespace clang::tooling;
 
 class PPSymbolCallbacks : public PPCallbacks
 {
 private:
-    set<string> *definitions;
+    StringSet<> *definitions;
 
 public:
-    PPSymbolCallbacks(set<string> *definitions) : definitions(definitions) {};
+    PPSymbolCallbacks(StringSet<> *definitions) : definitions(definitions) {};
     virtual void MacroDefined(const Token &macroNameTok, const MacroDirective *MD) override
     {
         StringRef name = macroNameTok.getIdentifierInfo()->getName();
-        definitions->emplace(name);
+        definitions->insert(name);
     }
 };
 
-PPSymbolsAction::PPSymbolsAction(set<string> *definitions) : definitions(definitions) {};
-unique_ptr<ASTConsumer> PPSymbolsAction::CreateASTConsumer(CompilerInstance &compiler, StringRef inFile)
+// anything that changes which headers get included and what they define
+uint64_t configFingerprint(CompilerInstance &compiler)
 {
-    // we just need to get preprocessor symbols
-    compiler.getPreprocessor().addPPCallbacks(make_unique<PPSymbolCallbacks>(definitions));
-    return make_unique<ASTConsumer>(); // don't actually need anything w/ the ast
+    HeaderSearchOptions &options = compiler.getHeaderSearchOpts();
+    string key = compiler.getPreprocessor().getPredefines();
+    key += '\0' + options.Sysroot + '\0' + options.ResourceDir;
+    for (const HeaderSearchOptions::Entry &entry : options.UserEntries)
+    {
+        key += '\0' + to_string((int)entry.Group) + entry.Path;
+    }
+    return xxHash64(key);
+}
+
+string realPath(FileEntryRef file)
+{
+    SmallString<256> path;
+    if (sys::fs::real_path(file.getName(), path))
+    {
+        return file.getName().str();
+    }
+    return path.str().str();
+}
+
+/**
+ * @brief Skips the headers the cache has fresh records for, and records the rest
+ *
+ * Cached names are a superset of what the header defines in this run, since
+ * they include every #define whether its branch is live or not. Recorded headers
+ * add the same superset to definitions, so a run gives the same definitions
+ * whether or not it skipped anything. A skipped header can't change which
+ * branches of later conditionals are live, so if any conditional tests a name
+ * that a skipped header defines, the cache is told to run again without skipping.
+ *
+ * The headers a record lists as included are the ones its live branches included,
+ * which depends on the macros defined before it. The predefined ones are part of
+ * the fingerprint, but the main file's aren't. So a header isn't recorded if its
+ * conditionals test a name the main file has defined by then, and a header isn't
+ * skipped if its conditionals, or those of a header it included, test a name that
+ * anything but the predefines has defined by then. The latter is a conflict too.
+ *
+ */
+class MacroCacheCallbacks : public PPCallbacks
+{
+private:
+    SourceManager &sm;
+    const LangOptions &lo;
+    Preprocessor &preproc;
+    MacroNameCache &cache;
+    StringSet<> *definitions;
+
+    StringSet<> skippable;         // headers marked as already included
+    StringSet<> unrecordable;      // headers that included what they did because of the main file
+    StringSet<> skippedNames;      // names defined by the headers that were skipped
+    StringSet<> tested;            // names tested by conditionals
+    vector<MacroNameCache::Header> headers;
+    StringMap<size_t> headerIndex; // real path to index in headers
+    DenseMap<FileID, size_t> fileHeaders;
+
+    // the definition name has at this point of the preprocessing, if it has one
+    const MacroInfo *definitionOf(StringRef name)
+    {
+        return preproc.getMacroInfo(preproc.getIdentifierInfo(name));
+    }
+
+    void testIdentifiers(SourceRange conditionRange)
+    {
+        if (!conditionRange.isValid())
+        {
+            return;
+        }
+        StringRef condition = Lexer::getSourceText(CharSourceRange::getTokenRange(conditionRange), sm, lo);
+        size_t i = 0;
+        while (i < condition.size())
+        {
+            if (!isAsciiIdentifierContinue(condition[i]))
+            {
+                ++i;
+                continue;
+            }
+            size_t start = i;
+            while (i < condition.size() && isAsciiIdentifierContinue(condition[i]))
+            {
+                ++i;
+            }
+            // numbers like 1UL aren't names
+            if (isAsciiIdentifierStart(condition[start]))
+            {
+                tested.insert(condition.slice(start, i));
+            }
+        }
+    }
+
+public:
+    MacroCacheCallbacks(Preprocessor &preproc, MacroNameCache &cache, StringSet<> *definitions)
+        : sm(preproc.getSourceManager()), lo(preproc.getLangOpts()), preproc(preproc), cache(cache), definitions(definitions) {}
+
+    // must come before the main file is entered
+    void skipFreshHeaders(FileManager &files, Preprocessor &preproc)
+    {
+        for (StringRef path : cache.headers())
+        {
+            if (!cache.isFresh(path))
+            {
+                continue;
+            }
+            if (OptionalFileEntryRef file = files.getOptionalFileRef(path))
+            {
+                // the next #include of it is skipped, like a #pragma once header seen before
+                preproc.getHeaderSearchInfo().MarkFileIncludeOnce(*file);
+                preproc.markIncluded(*file);
+                skippable.insert(path);
+            }
+        }
+    }
+
+    virtual void FileChanged(SourceLocation loc, FileChangeReason reason, SrcMgr::CharacteristicKind fileType, FileID prevFID) override
+    {
+        if (reason != EnterFile)
+        {
+            return;
+        }
+        FileID fid = sm.getFileID(loc);
+        OptionalFileEntryRef file = sm.getFileEntryRefForID(fid);
+        if (fid == sm.getMainFileID() || !file)
+        {
+            return;
+        }
+
+        string path = realPath(*file);
+        auto inserted = headerIndex.try_emplace(path, headers.size());
+        fileHeaders[fid] = inserted.first->second;
+        if (!inserted.second)
+        {
+            // entered again, it still defines the same names
+            return;
+        }
+        MacroNameCache::Header header;
+        header.path = path;
+        MacroNameCache::readStatus(header);
+        header.names = definedMacroNames(sm.getBufferData(fid));
+        for (const string &name : header.names)
+        {
+            definitions->insert(name);
+        }
+        header.tested = testedMacroNames(sm.getBufferData(fid));
+        for (const string &name : header.tested)
+        {
+            const MacroInfo *info = definitionOf(name);
+            if (info != nullptr && sm.isWrittenInMainFile(info->getDefinitionLoc()))
+            {
+                unrecordable.insert(path);
+                break;
+            }
+        }
+        headers.push_back(std::move(header));
+    }
+
+    virtual void InclusionDirective(SourceLocation hashLoc,
+                                    const Token &includeTok, StringRef fileName,
+                                    bool isAngled, CharSourceRange filenameRange,
+                                    OptionalFileEntryRef file,
+                                    StringRef searchPath, StringRef relativePath,
+                                    const Module *imported,
+                                    SrcMgr::CharacteristicKind fileType) override
+    {
+        auto it = fileHeaders.find(sm.getFileID(hashLoc));
+        if (it == fileHeaders.end() || !file)
+        {
+            return;
+        }
+        vector<string> &includes = headers[it->second].includes;
+        string path = realPath(*file);
+        if (find(includes.begin(), includes.end(), path) == includes.end())
+        {
+            includes.push_back(path);
+        }
+    }
+
+    virtual void FileSkipped(const FileEntryRef &skippedFile, const Token &filenameTok, SrcMgr::CharacteristicKind fileType) override
+    {
+        string path = realPath(skippedFile);
+        if (!skippable.contains(path))
+        {
+            return;
+        }
+        StringSet<> skippedTested;
+        cache.addNames(path, skippedNames, skippedTested);
+        for (const auto &name : skippedTested)
+        {
+            // the recorded includes may not be the ones these macros would give
+            const MacroInfo *info = definitionOf(name.getKey());
+            if (info != nullptr && !info->isBuiltinMacro() &&
+                sm.getFileID(info->getDefinitionLoc()) != preproc.getPredefinesFileID())
+            {
+                cache.reportSkipConflict();
+                return;
+            }
+        }
+    }
+
+    virtual void Ifdef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        tested.insert(macroNameTok.getIdentifierInfo()->getName());
+    }
+    virtual void Ifndef(SourceLocation loc, const Token &macroNameTok, const MacroDefinition &md) override
+    {
+        tested.insert(macroNameTok.getIdentifierInfo()->getName());
+    }
+    virtual void If(SourceLocation loc, SourceRange conditionRange, ConditionValueKind conditionValue) override
+    {
+        testIdentifiers(conditionRange);
+    }
+    virtual void Elif(SourceLocation loc, SourceRange conditionRange, ConditionValueKind conditionValue, SourceLocation ifLoc) override
+    {
+        testIdentifiers(conditionRange);
+    }
+
+    // once the whole translation unit has been preprocessed
+    void finish()
+    {
+        for (const auto &name : skippedNames)
+        {
+            definitions->insert(name.getKey());
+            if (tested.contains(name.getKey()))
+            {
+                cache.reportSkipConflict();
+            }
+        }
+        for (MacroNameCache::Header &header : headers)
+        {
+            if (!unrecordable.contains(header.path))
+            {
+                cache.record(std::move(header));
+            }
+        }
+    }
+};
+
+/**
+ * @brief Cuts each file down to its preprocessor directives before the preprocessor sees it
+ *
+ * This is what clang's dependency scanner does: the lexer then jumps from one
+ * directive to the next, so the code in between is never lexed, let alone parsed.
+ * Files the scanner can't handle are preprocessed as they are.
+ *
+ */
+class DirectivesOnly
+{
+private:
+    struct Scanned
+    {
+        SmallVector<dependency_directives_scan::Token, 0> tokens;
+        SmallVector<dependency_directives_scan::Directive, 0> directives;
+    };
+
+    SourceManager &sm;
+    DenseMap<const FileEntry *, unique_ptr<Scanned>> files; // null if the file couldn't be scanned
+
+public:
+    DirectivesOnly(SourceManager &sm) : sm(sm) {}
+
+    optional<ArrayRef<dependency_directives_scan::Directive>> get(FileEntryRef file)
+    {
+        unique_ptr<Scanned> &scanned = files[&file.getFileEntry()];
+        if (!scanned)
+        {
+            optional<MemoryBufferRef> buffer = sm.getMemoryBufferForFileOrNone(file);
+            if (!buffer)
+            {
+                return nullopt;
+            }
+            scanned = make_unique<Scanned>();
+            if (scanSourceForDependencyDirectives(buffer->getBuffer(), scanned->tokens, scanned->directives))
+            {
+                scanned->directives.clear();
+            }
+        }
+        if (scanned->directives.empty())
+        {
+            return nullopt;
+        }
+        return ArrayRef<dependency_directives_scan::Directive>(scanned->directives);
+    }
+};
+
+PPSymbolsAction::PPSymbolsAction(StringSet<> *definitions, MacroNameCache *cache) : definitions(definitions), cache(cache) {};
+void PPSymbolsAction::ExecuteAction()
+{
+    // we just need to get preprocessor symbols, so there is no need to parse anything
+    CompilerInstance &compiler = getCompilerInstance();
+    Preprocessor &preproc = compiler.getPreprocessor();
+    preproc.addPPCallbacks(make_unique<PPSymbolCallbacks>(definitions));
+    MacroCacheCallbacks *recorder = nullptr;
+    if (cache != nullptr)
+    {
+        cache->setFingerprint(configFingerprint(compiler));
+        auto callbacks = make_unique<MacroCacheCallbacks>(preproc, *cache, definitions);
+        if (cache->skippingEnabled())
+        {
+            callbacks->skipFreshHeaders(compiler.getFileManager(), preproc);
+        }
+        recorder = callbacks.get();
+        preproc.addPPCallbacks(std::move(callbacks));
+    }
+
+    DirectivesOnly directives(compiler.getSourceManager());
+    PreprocessorOptions &ppOptions = compiler.getPreprocessorOpts();
+    ppOptions.DependencyDirectivesForFile = [&directives](FileEntryRef file)
+    { return directives.get(file); };
+    PreprocessOnlyAction::ExecuteAction();
+    ppOptions.DependencyDirectivesForFile = nullptr;
+    if (recorder != nullptr)
+    {
+        recorder->finish();
+    }
 }
-unique_ptr<FrontendActionFactory> PPSymbolsAction::newPPSymbolsAction(set<string> *definitions)
+unique_ptr<FrontendActionFactory> PPSymbolsAction::newPPSymbolsAction(StringSet<> *definitions, MacroNameCache *cache)
 {
     class Adapter : public FrontendActionFactory
     {
     private:
-        set<string> *definitions;
+        StringSet<> *definitions;
+        MacroNameCache *cache;
 
     public:
-        Adapter(set<string> *definitions) : definitions(definitions) {};
+        Adapter(StringSet<> *definitions, MacroNameCache *cache) : definitions(definitions), cache(cache) {};
         virtual unique_ptr<FrontendAction> create() override
         {
-            return make_unique<PPSymbolsAction>(definitions);
+            return make_unique<PPSymbolsAction>(definitions, cache);
         }
     };
-    return make_unique<Adapter>(definitions);
-}
\ No newline at end of file
+    return make_unique<Adapter>(definitions, cache);
+}
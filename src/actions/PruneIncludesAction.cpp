@@ -0,0 +1,323 @@
+#include <actions/PruneIncludesAction.hpp>
+#include <clang/AST/ASTConsumer.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Lex/MacroInfo.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/DenseMap.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+
+// keeps track of the main file's #includes and which of them are needed
+class IncludeUses
+{
+private:
+    struct Include
+    {
+        unsigned begin; // main file offset of the #
+        unsigned end;   // main file offset of the end of the line
+        bool needed = false;
+    };
+
+    SourceManager &sm;
+    vector<Include> includes;       // in order
+    DenseMap<FileID, int> included; // which include each file was first entered through, -1 for none
+
+    // the include in the main file that the given file came in through
+    int includeFor(FileID fileId)
+    {
+        auto it = included.find(fileId);
+        if (it != included.end())
+        {
+            return it->second;
+        }
+        int result = -1;
+        SourceLocation includeLoc = sm.getIncludeLoc(fileId);
+        if (includeLoc.isValid())
+        {
+            FileID includer = sm.getFileID(includeLoc);
+            if (includer == sm.getMainFileID())
+            {
+                // the include location is on the line of the directive
+                unsigned offset = sm.getFileOffset(includeLoc);
+                auto directive = upper_bound(includes.begin(), includes.end(), offset, [](unsigned offset, const Include &include)
+                                             { return offset < include.begin; });
+                if (directive != includes.begin())
+                {
+                    result = directive - includes.begin() - 1;
+                }
+            }
+            else
+            {
+                result = includeFor(includer);
+            }
+        } // builtins and the command line weren't included by anything
+        included[fileId] = result;
+        return result;
+    }
+
+public:
+    IncludeUses(SourceManager &sm) : sm(sm) {}
+
+    void addInclude(SourceLocation hashLoc, SourceLocation filenameEnd)
+    {
+        StringRef code = sm.getBufferData(sm.getMainFileID());
+        unsigned begin = sm.getFileOffset(hashLoc);
+        size_t end = code.find('\n', sm.getFileOffset(filenameEnd));
+        includes.push_back(Include{begin, end == StringRef::npos ? (unsigned)code.size() : (unsigned)end});
+    }
+
+    // whatever is declared or defined at this location is used by the main file
+    void use(SourceLocation location)
+    {
+        if (location.isInvalid())
+        {
+            return;
+        }
+        FileID fileId = sm.getFileID(sm.getFileLoc(location));
+        if (fileId == sm.getMainFileID())
+        {
+            return;
+        }
+        int include = includeFor(fileId);
+        if (include >= 0)
+        {
+            includes[include].needed = true;
+        }
+    }
+
+    // the text of an include inside a declaration ends up in that declaration
+    void keepIncludesWithin(unsigned begin, unsigned end)
+    {
+        for (Include &include : includes)
+        {
+            if (include.begin >= begin && include.begin < end)
+            {
+                include.needed = true;
+            }
+        }
+    }
+
+    /**
+     * @brief Adds the deletion of every include that isn't needed
+     *
+     * @param replacements out
+     */
+    void removeUnneeded(Replacements *replacements)
+    {
+        StringRef filePath = sm.getFileEntryRefForID(sm.getMainFileID())->getName();
+        for (const Include &include : includes)
+        {
+            if (!include.needed)
+            {
+                cantFail(replacements->add(Replacement(filePath, include.begin, include.end - include.begin, "")));
+            }
+        }
+    }
+};
+
+class IncludeCallbacks : public PPCallbacks
+{
+private:
+    SourceManager &sm;
+    IncludeUses &uses;
+
+    void useMacro(SourceLocation location, const MacroDefinition &definition)
+    {
+        if (const MacroInfo *info = definition.getMacroInfo())
+        {
+            if (sm.isInMainFile(sm.getExpansionLoc(location)))
+            {
+                uses.use(info->getDefinitionLoc());
+            }
+        }
+    }
+
+public:
+    IncludeCallbacks(SourceManager &sm, IncludeUses &uses) : sm(sm), uses(uses) {}
+    virtual void InclusionDirective(SourceLocation hashLoc,
+                                    const Token &includeTok, StringRef fileName,
+                                    bool isAngled, CharSourceRange filenameRange,
+                                    OptionalFileEntryRef file,
+                                    StringRef searchPath, StringRef relativePath,
+                                    const Module *imported,
+                                    SrcMgr::CharacteristicKind fileType) override
+    {
+        if (sm.isWrittenInMainFile(hashLoc))
+        {
+            uses.addInclude(hashLoc, filenameRange.getEnd());
+        }
+    }
+
+    // macros expanded in the main file, including the ones other macros expand to
+    virtual void MacroExpands(const Token &macroNameTok, const MacroDefinition &definition, SourceRange range, const MacroArgs *args) override
+    {
+        useMacro(macroNameTok.getLocation(), definition);
+    }
+    virtual void Ifdef(SourceLocation location, const Token &macroNameTok, const MacroDefinition &definition) override
+    {
+        useMacro(location, definition);
+    }
+    virtual void Ifndef(SourceLocation location, const Token &macroNameTok, const MacroDefinition &definition) override
+    {
+        useMacro(location, definition);
+    }
+    virtual void Defined(const Token &macroNameTok, const MacroDefinition &definition, SourceRange range) override
+    {
+        useMacro(macroNameTok.getLocation(), definition);
+    }
+};
+
+// marks the headers of everything the main file's declarations refer to
+class IncludeUsesVisitor : public RecursiveASTVisitor<IncludeUsesVisitor>
+{
+private:
+    IncludeUses &uses;
+
+    // a template, along with the using declaration it was named through, if any
+    void useTemplateName(TemplateName name)
+    {
+        if (UsingShadowDecl *shadow = name.getAsUsingShadowDecl())
+        {
+            uses.use(shadow->getLocation());
+        }
+        if (TemplateDecl *decl = name.getAsTemplateDecl())
+        {
+            uses.use(decl->getLocation());
+        }
+    }
+
+public:
+    IncludeUsesVisitor(IncludeUses &uses) : uses(uses) {}
+
+    // the found declaration is a using declaration's shadow when the name came in through one
+    bool VisitDeclRefExpr(DeclRefExpr *expr)
+    {
+        uses.use(expr->getDecl()->getLocation());
+        uses.use(expr->getFoundDecl()->getLocation());
+        return true;
+    }
+    bool VisitMemberExpr(MemberExpr *expr)
+    {
+        uses.use(expr->getMemberDecl()->getLocation());
+        uses.use(expr->getFoundDecl().getDecl()->getLocation());
+        return true;
+    }
+    bool VisitEnumTypeLoc(EnumTypeLoc loc)
+    {
+        uses.use(loc.getDecl()->getLocation());
+        return true;
+    }
+    bool VisitRecordTypeLoc(RecordTypeLoc loc)
+    {
+        uses.use(loc.getDecl()->getLocation());
+        return true;
+    }
+    bool VisitTypedefTypeLoc(TypedefTypeLoc loc)
+    {
+        uses.use(loc.getTypedefNameDecl()->getLocation());
+        return true;
+    }
+
+    // C++ types like std::vector<int>, spelled with the name of the template
+    bool VisitTemplateSpecializationTypeLoc(TemplateSpecializationTypeLoc loc)
+    {
+        useTemplateName(loc.getTypePtr()->getTemplateName());
+        return true;
+    }
+    // a type named through a using declaration, which may come from a different header than the type
+    bool VisitUsingTypeLoc(UsingTypeLoc loc)
+    {
+        uses.use(loc.getFoundDecl()->getLocation());
+        uses.use(loc.getFoundDecl()->getTargetDecl()->getLocation());
+        return true;
+    }
+    // every other template name, like template template arguments and deduced class template arguments
+    bool TraverseTemplateName(TemplateName name)
+    {
+        useTemplateName(name);
+        return RecursiveASTVisitor<IncludeUsesVisitor>::TraverseTemplateName(name);
+    }
+};
+
+class IncludeUsesConsumer : public ASTConsumer
+{
+private:
+    Replacements *replacements;
+    IncludeUses uses;
+
+    // a definition with external linkage is needed when linking, even if nothing here uses it
+    static bool definesExternal(Decl *decl)
+    {
+        if (FunctionDecl *function = dyn_cast<FunctionDecl>(decl))
+        {
+            return function->doesThisDeclarationHaveABody() && !function->isInlineSpecified() && function->getStorageClass() != SC_Static;
+        }
+        if (VarDecl *var = dyn_cast<VarDecl>(decl))
+        {
+            return var->isThisDeclarationADefinition() != VarDecl::DeclarationOnly && var->getStorageClass() != SC_Static;
+        }
+        return false;
+    }
+
+public:
+    IncludeUsesConsumer(SourceManager &sm, Replacements *replacements) : replacements(replacements), uses(sm) {}
+
+    IncludeUses &getUses()
+    {
+        return uses;
+    }
+
+    virtual void HandleTranslationUnit(ASTContext &context) override
+    {
+        SourceManager &sm = context.getSourceManager();
+        IncludeUsesVisitor visitor(uses);
+        for (Decl *decl : context.getTranslationUnitDecl()->decls())
+        {
+            if (!sm.isInMainFile(sm.getExpansionLoc(decl->getLocation())))
+            {
+                if (definesExternal(decl))
+                {
+                    uses.use(decl->getLocation());
+                }
+                continue;
+            }
+            visitor.TraverseDecl(decl);
+            SourceLocation begin = sm.getExpansionLoc(decl->getBeginLoc());
+            SourceLocation end = sm.getExpansionLoc(decl->getEndLoc());
+            if (sm.isInMainFile(begin) && sm.isInMainFile(end))
+            {
+                uses.keepIncludesWithin(sm.getFileOffset(begin), sm.getFileOffset(end));
+            }
+        }
+        uses.removeUnneeded(replacements);
+    }
+};
+
+PruneIncludesAction::PruneIncludesAction(Replacements *replacements) : replacements(replacements) {}
+unique_ptr<ASTConsumer> PruneIncludesAction::CreateASTConsumer(CompilerInstance &compiler, StringRef inFile)
+{
+    unique_ptr<IncludeUsesConsumer> consumer = make_unique<IncludeUsesConsumer>(compiler.getSourceManager(), replacements);
+    compiler.getPreprocessor().addPPCallbacks(make_unique<IncludeCallbacks>(compiler.getSourceManager(), consumer->getUses()));
+    return consumer;
+}
+unique_ptr<FrontendActionFactory> PruneIncludesAction::newPruneIncludesAction(Replacements *replacements)
+{
+    class Adapter : public FrontendActionFactory
+    {
+    private:
+        Replacements *replacements;
+
+    public:
+        Adapter(Replacements *replacements) : replacements(replacements) {};
+        virtual unique_ptr<FrontendAction> create() override
+        {
+            return make_unique<PruneIncludesAction>(replacements);
+        }
+    };
+    return make_unique<Adapter>(replacements);
+}
@@ -0,0 +1,119 @@
+#include <util/defines.hpp>
+#include <util/tokens.hpp>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+using namespace std;
+using namespace llvm;
+
+// minifier-lite: the stages of the minifier that only need a raw lexer, so it never
+// parses, renames nothing, and needs no compilation options or headers
+
+// arguments
+static cl::OptionCategory options("Minifier Options");
+static cl::opt<std::string> file(
+    cl::Positional,
+    cl::desc("[source]"),
+    cl::cat(options));
+static cl::opt<bool> inPlace(
+    "i",
+    cl::desc("Whether to process the file in place, only works if [source] is specified"),
+    cl::value_desc("inplace"), cl::init(false), cl::cat(options));
+static cl::opt<bool> noAddMacros(
+    "no-add-macros",
+    cl::desc("Disable minimizing the file by finding repeated subsequences and defining those as body macros"),
+    cl::value_desc("no-add-macros"), cl::init(false), cl::cat(options));
+static cl::opt<bool> noNiceMacros(
+    "no-nice-macros",
+    cl::desc("Disable only adding body macros that have matched open/close parentheses/brackets/braces"),
+    cl::value_desc("no-nice-macros"), cl::init(false), cl::cat(options));
+static cl::opt<bool> portfolio(
+    "portfolio",
+    cl::desc("Try several define search strategies in parallel and keep the smallest result"),
+    cl::value_desc("portfolio"), cl::init(false), cl::cat(options));
+static cl::opt<bool> sharded(
+    "sharded",
+    cl::desc("Find repeated token sequences per top level declaration in parallel, trading some size for speed on large files"),
+    cl::value_desc("sharded"), cl::init(false), cl::cat(options));
+static cl::opt<int> defineWindow(
+    "define-window",
+    cl::desc("Search for repeated token sequences in windows of this many tokens, bounding memory on huge files"),
+    cl::value_desc("tokens"), cl::init(0), cl::cat(options));
+static cl::opt<int> jobs(
+    "jobs",
+    cl::desc("Maximum number of threads to use, 0 to use one per hardware thread"),
+    cl::value_desc("jobs"), cl::init(0), cl::cat(options));
+
+int main(int argc, const char **argv)
+{
+    // parse command line options
+    cl::HideUnrelatedOptions(options);
+    cl::ParseCommandLineOptions(
+        argc, argv,
+        "A tool to format C code without parsing it\n\n"
+        "Removes comments and whitespace and replaces repeated tokens with macros,\n"
+        "but renames nothing, so no compilation options or headers are needed.\n"
+        "If a file is provided, the contents of the file is read and formatted.\n"
+        "Otherwise, the code to format is assumed to be on stdin.\n"
+        "If -i is specified, the file is edited in-place. This only works when\n"
+        "an input file is specified. Otherwise, the result is written to the stdout.\n");
+
+    // read in file
+    string fileName = file.getValue();
+    bool fromSTDIN = fileName.empty();
+    ErrorOr<unique_ptr<MemoryBuffer>> codeOrErr = fromSTDIN ? MemoryBuffer::getSTDIN() : MemoryBuffer::getFileAsStream(fileName);
+    if (std::error_code ec = codeOrErr.getError())
+    {
+        errs() << (fromSTDIN ? "stdin" : fileName) << ": " << ec.message() << "\n";
+        return fromSTDIN ? 1 : 2;
+    }
+    StringRef code = codeOrErr.get()->getBuffer();
+
+    // the same last stages as the minifier, with nothing renamed before them
+    TokenStream tokens;
+    if (noAddMacros.getValue())
+    {
+        lexTokens(code, tokens);
+    }
+    else
+    {
+        AddDefinesOptions defineOptions;
+        defineOptions.strategies = {DefineStrategy(!noNiceMacros.getValue(), CandidateOrder::SuffixOrder, false)};
+        if (portfolio.getValue() && (sharded.getValue() || defineWindow.getValue() > 0))
+        {
+            // those searches only ever run one strategy
+            errs() << "--sharded and --define-window run a single define search, ignoring --portfolio\n";
+        }
+        else if (portfolio.getValue())
+        {
+            defineOptions.strategies = definePortfolio(noNiceMacros.getValue());
+        }
+        defineOptions.jobs = jobs.getValue();
+        defineOptions.sharded = sharded.getValue();
+        defineOptions.windowSize = defineWindow.getValue();
+        // nothing was renamed, so the defines can start from the first name. they may still be named after
+        // something only a header spells, which is why they go after the includes where no header sees them
+        defineOptions.afterIncludes = true;
+        addDefines(code, 0, defineOptions, &tokens);
+    }
+    string output = renderTokens(tokens);
+
+    // output.
+    if (inPlace.getValue() && !fromSTDIN)
+    {
+        error_code ec;
+        raw_fd_ostream out(fileName, ec);
+        if (ec)
+        {
+            errs() << fileName << ": " << ec.message() << "\n";
+            return 2;
+        }
+        out << output;
+    }
+    else
+    {
+        outs() << output;
+    }
+    return 0;
+}
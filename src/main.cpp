@@ -1,9 +1,18 @@
-#include <actions/AddDefinesAction.hpp>
 #include <actions/ExpandMacroAction.hpp>
 #include <actions/FormatAction.hpp>
 #include <actions/MinifySymbolsAction.hpp>
 #include <actions/PPSymbolsAction.hpp>
+#include <actions/PruneIncludesAction.hpp>
+#include <util/defines.hpp>
+#include <util/format.hpp>
+#include <util/macrocache.hpp>
+#include <util/tokens.hpp>
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Frontend/FrontendActions.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Errno.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Rewrite/Core/Rewriter.h>
 #include <string>
@@ -11,6 +20,7 @@
 #include <sstream>
 #include <chrono>
 #include <thread>
+#include <cstdio>
 using namespace std;
 using namespace clang;
 using namespace clang::tooling;
@@ -30,6 +40,26 @@ static cl::opt<bool> expandAll(
     "expand-all",
     cl::desc("Whether to expand all macros encountered in the source file"),
     cl::value_desc("expand-all"), cl::init(false), cl::cat(options));
+static cl::opt<bool> expandUnhygienic(
+    "expand-unhygienic",
+    cl::desc("Expand only the macros that keep symbols from being renamed, and remove their definitions"),
+    cl::value_desc("expand-unhygienic"), cl::init(false), cl::cat(options));
+static cl::opt<bool> stripConditionals(
+    "strip-conditionals",
+    cl::desc("Evaluate the source file's #if/#ifdef/... with the given -D/-U flags and keep only the live branches"),
+    cl::value_desc("strip-conditionals"), cl::init(false), cl::cat(options));
+static cl::opt<bool> pruneIncludes(
+    "prune-includes",
+    cl::desc("Remove #includes that supply nothing the source file uses"),
+    cl::value_desc("prune-includes"), cl::init(false), cl::cat(options));
+static cl::opt<bool> removeUnused(
+    "remove-unused",
+    cl::desc("Remove static functions and variables, types, and typedefs that nothing in the program uses"),
+    cl::value_desc("remove-unused"), cl::init(false), cl::cat(options));
+static cl::opt<bool> shortenLiterals(
+    "shorten-literals",
+    cl::desc("Respell integer, character and floating literals as short as their type and value allow"),
+    cl::value_desc("shorten-literals"), cl::init(false), cl::cat(options));
 static cl::opt<bool> noAddMacros(
     "no-add-macros",
     cl::desc("Disable minimizing the file by finding repeated subsequences and defining those as body macros"),
@@ -38,6 +68,42 @@ static cl::opt<bool> noNiceMacros(
     "no-nice-macros",
     cl::desc("Disable only adding body macros that have matched open/close parentheses/brackets/braces"),
     cl::value_desc("no-nice-macros"), cl::init(false), cl::cat(options));
+static cl::opt<bool> portfolio(
+    "portfolio",
+    cl::desc("Try several define search strategies in parallel and keep the smallest result"),
+    cl::value_desc("portfolio"), cl::init(false), cl::cat(options));
+static cl::opt<bool> sharded(
+    "sharded",
+    cl::desc("Find repeated token sequences per top level declaration in parallel, trading some size for speed on large files"),
+    cl::value_desc("sharded"), cl::init(false), cl::cat(options));
+static cl::opt<int> defineWindow(
+    "define-window",
+    cl::desc("Search for repeated token sequences in windows of this many tokens, bounding memory on huge files"),
+    cl::value_desc("tokens"), cl::init(0), cl::cat(options));
+static cl::opt<std::string> checkpoint(
+    "checkpoint",
+    cl::desc("Periodically save the state of the define search to this file"),
+    cl::value_desc("file"), cl::init(""), cl::cat(options));
+static cl::opt<int> checkpointInterval(
+    "checkpoint-interval",
+    cl::desc("Seconds between checkpoints of the define search"),
+    cl::value_desc("seconds"), cl::init(60), cl::cat(options));
+static cl::opt<bool> resume(
+    "resume",
+    cl::desc("Continue the define search from the file given with --checkpoint"),
+    cl::value_desc("resume"), cl::init(false), cl::cat(options));
+static cl::opt<bool> formatOnly(
+    "format-only",
+    cl::desc("Only remove comments and whitespace, streaming the source without clang. Ignores every other option but -i"),
+    cl::value_desc("format-only"), cl::init(false), cl::cat(options));
+static cl::opt<std::string> macroCache(
+    "macro-cache",
+    cl::desc("File that caches the macro names each header defines, so later runs can skip preprocessing unchanged headers"),
+    cl::value_desc("macro-cache"), cl::init(""), cl::cat(options));
+static cl::opt<int> jobs(
+    "jobs",
+    cl::desc("Maximum number of threads to use, 0 to use one per hardware thread"),
+    cl::value_desc("jobs"), cl::init(0), cl::cat(options));
 static cl::list<std::string> argsAfter(
     "extra-arg",
     cl::desc("Additional argument to append to the compiler command line"),
@@ -53,6 +119,60 @@ bool writeToFile(const StringRef fileName, const StringRef code)
     return !ec;
 }
 
+/**
+ * @brief Removes comments and whitespace without parsing, for inputs too big to give to clang
+ *
+ * @param fileName the file to read, or empty for stdin
+ * @param inPlace whether to replace the file with the result rather than writing to stdout
+ * @return int the exit code
+ */
+int formatOnlyMain(const string &fileName, bool inPlace)
+{
+    FILE *in = fileName.empty() ? stdin : fopen(fileName.c_str(), "rb");
+    if (in == nullptr)
+    {
+        errs() << fileName << ": " << sys::StrError() << "\n";
+        return 2;
+    }
+
+    if (!inPlace || fileName.empty())
+    {
+        bool success = formatStream(in, outs());
+        if (in != stdin)
+        {
+            fclose(in);
+        }
+        if (!success)
+        {
+            errs() << "failed to read input: " << sys::StrError() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // write next to the file and only replace it once everything was read
+    string tmpFileName = fileName + ".minified";
+    error_code ec;
+    raw_fd_ostream out(tmpFileName, ec);
+    if (ec)
+    {
+        errs() << tmpFileName << ": " << ec.message() << "\n";
+        fclose(in);
+        return 2;
+    }
+    bool success = formatStream(in, out);
+    fclose(in);
+    out.close();
+    if (!success || out.has_error() || sys::fs::rename(tmpFileName, fileName))
+    {
+        errs() << "failed to minify " << fileName << " in place\n";
+        out.clear_error();
+        sys::fs::remove(tmpFileName);
+        return 1;
+    }
+    return 0;
+}
+
 // helper function to create a clang tool
 ClangTool createTool(CompilationDatabase *compDB, string mainFileName, IntrusiveRefCntPtr<vfs::FileSystem> vfs)
 {
@@ -60,6 +180,44 @@ ClangTool createTool(CompilationDatabase *compDB, string mainFileName, Intrusive
     return ClangTool(*compDB, {mainFileName}, make_shared<PCHContainerOperations>(), vfs);
 }
 
+/**
+ * @brief Whether the code was already preprocessed, and so starts with a line marker like `# 1 "file.c"`
+ *
+ * @param fileName
+ * @param code
+ * @return true if the file is a .i file or starts with a line marker
+ */
+bool isPreprocessed(StringRef fileName, StringRef code)
+{
+    if (sys::path::extension(fileName) == ".i")
+    {
+        return true;
+    }
+    StringRef line = code.ltrim();
+    if (line.empty() || line.front() != '#')
+    {
+        return false;
+    }
+    line = line.drop_front().ltrim(" \t");
+    if (line.empty() || !isdigit((unsigned char)line.front()))
+    {
+        return false;
+    }
+    line = line.drop_while([](char c)
+                           { return isdigit((unsigned char)c); })
+               .ltrim(" \t");
+    return !line.empty() && line.front() == '"';
+}
+
+// helper function to replace the main file's contents
+void setMainFileContents(IntrusiveRefCntPtr<vfs::OverlayFileSystem> vfs, const string &mainFileName, StringRef contents)
+{
+    // since there's no direct way to edit, simply add a new layer on top to override the contents
+    IntrusiveRefCntPtr<vfs::InMemoryFileSystem> topLayer = new vfs::InMemoryFileSystem();
+    topLayer->addFile(mainFileName, 0, MemoryBuffer::getMemBufferCopy(contents));
+    vfs->pushOverlay(topLayer);
+}
+
 /**
  * @brief Updates the main file's contents
  *
@@ -78,10 +236,7 @@ bool updateMainFileContents(IntrusiveRefCntPtr<vfs::OverlayFileSystem> vfs, cons
     }
 
     // update the file in the overlay
-    // since there's no direct way to edit, simply add a new layer on top to override the contents
-    IntrusiveRefCntPtr<vfs::InMemoryFileSystem> topLayer = new vfs::InMemoryFileSystem();
-    topLayer->addFile(mainFileName, 0, MemoryBuffer::getMemBufferCopy(*mainFileContentsAfterReplacements));
-    vfs->pushOverlay(topLayer);
+    setMainFileContents(vfs, mainFileName, *mainFileContentsAfterReplacements);
     return true;
 }
 
@@ -99,6 +254,12 @@ int main(int argc, const char **argv)
         "If -i is specified, the file is edited in-place. This only works when\n"
         "an input file is specified. Otherwise, the result is written to the stdout.\n");
 
+    // nothing else needs clang, or the whole file in memory
+    if (formatOnly.getValue())
+    {
+        return formatOnlyMain(file.getValue(), inPlace.getValue());
+    }
+
     // read in file
     string fileName = file.getValue();
     unique_ptr<MemoryBuffer> code;
@@ -126,8 +287,16 @@ int main(int argc, const char **argv)
         code = std::move(codeOrErr.get());
     }
 
+    // preprocessed input has no #includes or macros left, and its line markers tell apart what
+    // came from headers, so clang sees it as such and only needs options it can default
+    bool preprocessed = isPreprocessed(fileName, code->getBuffer());
+    if (compDB == nullptr && preprocessed)
+    {
+        compDB = make_unique<FixedCompilationDatabase>(".", vector<string>());
+    }
+
     // create FS and set up file
-    const string tmpFileName = "/tmp/golfC-Minifier.c";
+    const string tmpFileName = preprocessed ? "/tmp/golfC-Minifier.i" : "/tmp/golfC-Minifier.c";
     IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> overlayFS = new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem());
     IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> inMemoryFileSystem = new llvm::vfs::InMemoryFileSystem();
     overlayFS->pushOverlay(inMemoryFileSystem);
@@ -141,14 +310,76 @@ int main(int argc, const char **argv)
     }
     Replacements replacements;
 
+    // drop the branches that are dead for this configuration before anything else looks at them
+    if (stripConditionals.getValue())
+    {
+        createTool(compDB.get(), tmpFileName, overlayFS).run(ExpandMacroAction::newExpandMacroAction(&replacements, ExpandMode::ConditionalsOnly).get());
+        if (!updateMainFileContents(overlayFS, tmpFileName, replacements))
+        {
+            errs() << "Failed to apply strip conditionals rewrites\n";
+            return 10;
+        }
+        replacements = Replacements();
+    }
+
+    // drop the includes nothing needs, so that every later stage parses less
+    if (pruneIncludes.getValue())
+    {
+        string original = overlayFS->getBufferForFile(tmpFileName)->get()->getBuffer().str();
+        createTool(compDB.get(), tmpFileName, overlayFS).run(PruneIncludesAction::newPruneIncludesAction(&replacements).get());
+        if (!updateMainFileContents(overlayFS, tmpFileName, replacements))
+        {
+            errs() << "Failed to apply prune includes rewrites\n";
+            return 9;
+        }
+
+        // some headers only work when another one comes first, so make sure it still compiles
+        ClangTool verifier = createTool(compDB.get(), tmpFileName, overlayFS);
+        IgnoringDiagConsumer ignoreDiagnostics;
+        verifier.setDiagnosticConsumer(&ignoreDiagnostics);
+        if (verifier.run(newFrontendActionFactory<SyntaxOnlyAction>().get()) != 0)
+        {
+            errs() << "Source no longer compiles without the unused includes, keeping all of them\n";
+            setMainFileContents(overlayFS, tmpFileName, original);
+        }
+        replacements = Replacements();
+    }
+
     // first, get existing preprocessor defines
-    set<string> definitions;
-    createTool(compDB.get(), tmpFileName, overlayFS).run(PPSymbolsAction::newPPSymbolsAction(&definitions).get());
+    StringSet<> definitions;
+    if (preprocessed)
+    {
+        // -dD output still has its #defines, but nothing needs preprocessing to find them
+        for (const string &name : definedMacroNames(code->getBuffer()))
+        {
+            definitions.insert(name);
+        }
+    }
+    else if (macroCache.getValue().empty())
+    {
+        createTool(compDB.get(), tmpFileName, overlayFS).run(PPSymbolsAction::newPPSymbolsAction(&definitions).get());
+    }
+    else
+    {
+        MacroNameCache cache(macroCache.getValue());
+        createTool(compDB.get(), tmpFileName, overlayFS).run(PPSymbolsAction::newPPSymbolsAction(&definitions, &cache).get());
+        if (cache.hadSkipConflict())
+        {
+            // a skipped header defines something a conditional tests, so its branches may have been wrong
+            definitions.clear();
+            createTool(compDB.get(), tmpFileName, overlayFS).run(PPSymbolsAction::newPPSymbolsAction(&definitions, &cache).get());
+        }
+        if (!cache.save())
+        {
+            errs() << "Failed to write the macro cache, continuing without it\n";
+        }
+    }
 
     // next up, expand macros and save the results
-    if (expandAll.getValue())
+    if (expandAll.getValue() || expandUnhygienic.getValue())
     {
-        createTool(compDB.get(), tmpFileName, overlayFS).run(ExpandMacroAction::newExpandMacroAction(&replacements).get());
+        ExpandMode mode = expandAll.getValue() ? ExpandMode::AllMacros : ExpandMode::Unhygienic;
+        createTool(compDB.get(), tmpFileName, overlayFS).run(ExpandMacroAction::newExpandMacroAction(&replacements, mode).get());
         if (!updateMainFileContents(overlayFS, tmpFileName, replacements))
         {
             errs() << "Failed to apply expand macros action\n";
@@ -159,7 +390,11 @@ int main(int argc, const char **argv)
     // then run the variable minify tool
     replacements = Replacements();
     int firstUnusedSymbol = 0;
-    createTool(compDB.get(), tmpFileName, overlayFS).run(MinifySymbolsAction::newMinifierAction(&replacements, &definitions, &firstUnusedSymbol).get());
+    MinifySymbolsOptions minifyOptions;
+    minifyOptions.jobs = jobs.getValue();
+    minifyOptions.removeUnused = removeUnused.getValue();
+    minifyOptions.shortenLiterals = shortenLiterals.getValue();
+    createTool(compDB.get(), tmpFileName, overlayFS).run(MinifySymbolsAction::newMinifierAction(&replacements, &definitions, &firstUnusedSymbol, minifyOptions).get());
     // apply those rewrites
     if (!updateMainFileContents(overlayFS, tmpFileName, replacements))
     {
@@ -168,29 +403,49 @@ int main(int argc, const char **argv)
     }
 
     // combine / add macros
+    string finalOutput;
     if (!noAddMacros.getValue())
     {
-        replacements = Replacements();
-        createTool(compDB.get(), tmpFileName, overlayFS).run(AddDefinesAction::newAddDefinesAction(firstUnusedSymbol, !noNiceMacros.getValue(), &replacements).get());
-        // apply the rewrites
-        if (!updateMainFileContents(overlayFS, tmpFileName, replacements))
+        AddDefinesOptions defineOptions;
+        defineOptions.strategies = {DefineStrategy(!noNiceMacros.getValue(), CandidateOrder::SuffixOrder, false)};
+        if (portfolio.getValue() && (sharded.getValue() || defineWindow.getValue() > 0))
+        {
+            // those searches only ever run one strategy
+            errs() << "--sharded and --define-window run a single define search, ignoring --portfolio\n";
+        }
+        else if (portfolio.getValue())
+        {
+            defineOptions.strategies = definePortfolio(noNiceMacros.getValue());
+        }
+        defineOptions.jobs = jobs.getValue();
+        defineOptions.sharded = sharded.getValue();
+        defineOptions.windowSize = defineWindow.getValue();
+        defineOptions.checkpointPath = checkpoint.getValue();
+        defineOptions.checkpointInterval = checkpointInterval.getValue();
+        defineOptions.resume = resume.getValue();
+        if (defineOptions.resume && defineOptions.checkpointPath.empty())
         {
-            errs() << "Failed to apply macro format rewrites!\n";
-            return 7;
+            errs() << "There is nothing to resume without --checkpoint, ignoring --resume\n";
+            defineOptions.resume = false;
         }
+        if (!defineOptions.checkpointPath.empty() && (portfolio.getValue() || sharded.getValue() || defineWindow.getValue() > 0))
+        {
+            errs() << "Checkpoints only apply to the default define search, ignoring --checkpoint\n";
+            defineOptions.checkpointPath = "";
+        }
+        // only the raw lexer is needed from here on, so the stages run straight on the buffer.
+        // the result comes back as tokens, so it only has to be written out without extra spaces
+        TokenStream tokens;
+        addDefines(overlayFS->getBufferForFile(tmpFileName)->get()->getBuffer(), firstUnusedSymbol, defineOptions, &tokens);
+        finalOutput = renderTokens(tokens);
     }
-    // minify format (remove spaces)
-    replacements = Replacements();
-    createTool(compDB.get(), tmpFileName, overlayFS).run(FormatAction::newFormatAction(&replacements).get());
-    // save format replacements too
-    if (!updateMainFileContents(overlayFS, tmpFileName, replacements))
+    else
     {
-        llvm::errs() << "Failed to apply minify format rewrites\n";
-        return 8;
+        // minify format (remove spaces)
+        finalOutput = FormatAction::format(overlayFS->getBufferForFile(tmpFileName)->get()->getBuffer());
     }
 
     // output.
-    StringRef finalOutput = overlayFS->getBufferForFile(tmpFileName)->get()->getBuffer();
     if (inPlace.getValue() && !fromSTDIN)
     {
         writeToFile(fileName, finalOutput);
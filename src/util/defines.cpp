@@ -0,0 +1,1539 @@
+#include <util/defines.hpp>
+#include <util/parallel.hpp>
+#include <util/symbols.hpp>
+#include <util/tokens.hpp>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/StringSaver.h>
+#include <llvm/Support/xxhash.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <sstream>
+#include <tuple>
+
+// namespaces
+using namespace clang;
+using namespace llvm;
+using namespace std;
+
+const int DEFINE_WEIGHT = 10;
+const int MULTI_PICK_CANDIDATES = 8; // candidates kept per suffix array by multi-pick strategies
+const int SHARD_MAX_SEQUENCE = 16;   // longest sequence counted by the sharded search
+const int SHARD_MIN_TOKENS = 4096;   // declarations are grouped into shards of at least this many tokens
+const int SHARD_CANDIDATES = 512;    // merged candidates checked per round of the sharded search
+const int WINDOW_SUMMARY = 1 << 16;  // entries the windowed search keeps in its global summary
+const uint32_t CHECKPOINT_MAGIC = 0x4b43444d; // "MDCK"
+
+struct TokenInfo
+{
+    StringRef spelling; // points into the storage of a TokenTable
+    bool isPP;
+    bool isPunctuator;
+    int weight;
+
+    // ctor
+    TokenInfo() : isPP(false), isPunctuator(false), weight(0) {}
+    TokenInfo(StringRef spelling, bool isPP, bool isPunctuator, int weight) : spelling(spelling), isPP(isPP), isPunctuator(isPunctuator), weight(weight) {}
+};
+
+// interned tokens of the file, the starting point of every strategy
+struct TokenTable
+{
+    vector<int> tokenNumbers;
+    vector<TokenInfo> reverseDistinctTokens;       // indexed by token number
+    vector<shared_ptr<BumpPtrAllocator>> storage; // owns the spellings
+    shared_ptr<const StringSet<>> identifiers;     // everything the file spells like an identifier, directives included
+};
+
+// what turning token numbers back into tokens needs from the stream they came from,
+// kept apart so that the stream, which is as big as the file, can go before the search
+struct SourceTokens
+{
+    vector<tok::TokenKind> kinds;                 // kind of the first token spelled like each token number
+    TokenStream ppLines;                          // the tokens of every distinct preprocessor line
+    vector<pair<uint32_t, uint32_t>> ppLineRanges; // first entry in ppLines and number of entries, by token number
+};
+
+// interns the file's tokens from entry first on into token numbers, along with what's needed to turn them back into tokens.
+// preprocessor lines get combined into a single token, spelled without the surrounding newlines
+pair<TokenTable, SourceTokens> getTokens(const TokenStream &stream, uint32_t first)
+{
+    // initialize result
+    TokenTable table;
+    table.storage.push_back(stream.getStorage());
+    table.storage.push_back(make_shared<BumpPtrAllocator>());
+    StringSaver saver(*table.storage.back());
+    SourceTokens source;
+    vector<int> numbers(stream.spellings.size(), -1); // token number of each spelling outside of preprocessor lines
+    DenseMap<StringRef, int> distinctPPTokens;
+
+    const vector<TokenStream::Entry> &entries = stream.entries;
+    auto identifiers = make_shared<StringSet<>>();
+    for (const TokenStream::Entry &entry : entries)
+    {
+        if (entry.kind == tok::raw_identifier)
+        {
+            identifiers->insert(stream.spelling(entry));
+        }
+    }
+    table.identifiers = std::move(identifiers);
+
+    uint32_t i = first;
+    while (i < entries.size())
+    {
+        const TokenStream::Entry &entry = entries[i];
+        if (entry.kind == tok::hash && (entry.flags & TokenStream::StartOfLine))
+        {
+            // combine everything in this preprocessor into one token,
+            // separating tokens with a single space wherever the source had any whitespace
+            uint32_t first = i;
+            SmallString<128> normalized(stream.spelling(entry));
+            for (++i; i < entries.size() && !(entries[i].flags & TokenStream::StartOfLine); ++i)
+            {
+                if (entries[i].flags & TokenStream::LeadingSpace)
+                {
+                    normalized += ' ';
+                }
+                normalized += stream.spelling(entries[i]);
+            }
+
+            // a weight of 0 means later algorithms will never touch this
+            auto it = distinctPPTokens.find(normalized.str());
+            if (it == distinctPPTokens.end())
+            {
+                StringRef spelling = saver.save(normalized.str());
+                it = distinctPPTokens.try_emplace(spelling, table.reverseDistinctTokens.size()).first;
+                table.reverseDistinctTokens.push_back(TokenInfo(spelling, true, false, 0));
+                source.kinds.push_back(entry.kind);
+                source.ppLineRanges.push_back({(uint32_t)source.ppLines.entries.size(), i - first});
+                for (uint32_t j = first; j < i; ++j)
+                {
+                    source.ppLines.add(stream.spelling(entries[j]), entries[j].kind, entries[j].flags, entries[j].offset);
+                }
+            }
+            table.tokenNumbers.push_back(it->second);
+            continue;
+        }
+
+        // equal spellings already share a spelling number
+        int &number = numbers[entry.spelling];
+        if (number < 0)
+        {
+            number = table.reverseDistinctTokens.size();
+            StringRef spelling = stream.spelling(entry);
+            // special case for main, which must keep its name
+            table.reverseDistinctTokens.push_back(TokenInfo(spelling, false, entry.flags & TokenStream::Punctuator, spelling == "main" ? 0 : spelling.size()));
+            source.kinds.push_back(entry.kind);
+            source.ppLineRanges.push_back({0, 0});
+        }
+        table.tokenNumbers.push_back(number);
+        ++i;
+    }
+
+    return {std::move(table), std::move(source)};
+}
+
+/**
+ * @brief The first entry defines may go in front of without any header seeing them
+ *
+ * That is right after the last #include, unless an #else, #elif or #endif later on
+ * closes a conditional block the #include is in while code still follows, in which
+ * case it is after the last of those, so the defines reach all the code after them.
+ *
+ * @param stream
+ * @return uint32_t 0 if the file includes nothing
+ */
+uint32_t afterLastInclude(const TokenStream &stream)
+{
+    const vector<TokenStream::Entry> &entries = stream.entries;
+    uint32_t lastCode = 0; // one past the last token outside of preprocessor lines
+    bool inDirective = false;
+    for (uint32_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].flags & TokenStream::StartOfLine)
+        {
+            inDirective = entries[i].kind == tok::hash;
+        }
+        if (!inDirective)
+        {
+            lastCode = i + 1;
+        }
+    }
+
+    uint32_t point = 0;
+    int pointDepth = 0; // conditional blocks the point is in
+    int depth = 0;
+    uint32_t i = 0;
+    while (i < entries.size())
+    {
+        if (!(entries[i].kind == tok::hash && (entries[i].flags & TokenStream::StartOfLine)))
+        {
+            ++i;
+            continue;
+        }
+        uint32_t start = i;
+        StringRef name = i + 1 < entries.size() && !(entries[i + 1].flags & TokenStream::StartOfLine) ? stream.spelling(entries[i + 1]) : "";
+        for (++i; i < entries.size() && !(entries[i].flags & TokenStream::StartOfLine); ++i)
+        {
+        }
+
+        // depth is the number of blocks open before this line, the last of which an #else or #endif belongs to
+        bool closesBlock = name == "endif" || name == "else" || name == "elif" || name == "elifdef" || name == "elifndef";
+        if (name == "include" || name == "include_next" || name == "import" || (closesBlock && depth <= pointDepth && point != 0 && start < lastCode))
+        {
+            point = i;
+            pointDepth = name == "endif" ? depth - 1 : depth;
+        }
+        if (name == "if" || name == "ifdef" || name == "ifndef")
+        {
+            ++depth;
+        }
+        else if (name == "endif")
+        {
+            --depth;
+        }
+    }
+    return point;
+}
+vector<int> sortCyclicShifts(const vector<int> &arr)
+{
+    int n = arr.size();
+
+    // p holds permuation (order)
+    // c holds equivalence class
+    vector<int> p(n), c(n);
+
+    // sort by first letter
+    // then use that knowledge to combine 2 strings of length l
+    // to make a string of length l*2
+
+    // sort by first letter
+    for (int i = 0; i < n; ++i)
+    {
+        p[i] = i;
+    }
+    std::sort(p.begin(), p.end(), [&arr](int a, int b)
+              { return arr[a] < arr[b]; });
+
+    // now fill in equivalency classes
+    c[p[0]] = 0;
+    int classes = 1;
+    for (int i = 1; i < n; ++i)
+    {
+        if (arr[p[i]] != arr[p[i - 1]])
+        {
+            // new equivalency class
+            ++classes;
+        }
+        c[p[i]] = classes - 1;
+    }
+
+    // now we can combine strings
+    vector<int> pn(n);
+    vector<int> cn(n);
+    vector<int> counts(n); // preallocate space for the counts array used for the count sort
+    for (int k = 0; (1 << k) < n; ++k)
+    {
+        // first, populate p_n
+        for (int i = 0; i < n; ++i)
+        {
+            pn[i] = p[i] - (1 << k);
+            if (pn[i] < 0)
+            {
+                pn[i] += n;
+            }
+        }
+
+        // then sort by the item
+        // but first, clear (only the items that we will use in) counts
+        fill(counts.begin(), counts.begin() + classes, 0);
+        for (int i = 0; i < n; ++i)
+        {
+            counts[c[pn[i]]]++;
+        }
+        // accumulate for counting sort
+        for (int i = 1; i < classes; ++i)
+        {
+            counts[i] += counts[i - 1];
+        }
+        // finish count sort
+        for (int i = n - 1; i > -1; --i)
+        {
+            p[--counts[c[pn[i]]]] = pn[i];
+        }
+
+        cn[p[0]] = 0;
+        classes = 1;
+        for (int i = 1; i < n; ++i)
+        {
+            pair<int, int> cur = {c[p[i]], c[(p[i] + (1 << k)) % n]};
+            pair<int, int> prev = {c[p[i - 1]], c[(p[i - 1] + (1 << k)) % n]};
+            if (cur != prev)
+            {
+                ++classes;
+            }
+            cn[p[i]] = classes - 1;
+        }
+        // swap c and cn
+        c.swap(cn);
+    }
+    return p;
+}
+vector<int> constructSuffixArray(vector<int> &arr)
+{
+    arr.push_back(-1); // smallest number (since all arr numbers >= 0), so guaranteed to end up at front
+    vector<int> sortedShifts = sortCyclicShifts(arr);
+    arr.pop_back();                           // undo change to arr
+    sortedShifts.erase(sortedShifts.begin()); // get rid of the thing associated with our "-1"; O(n) operation
+    return sortedShifts;
+}
+vector<int> constructLCPArray(vector<int> &arr, vector<int> &suffixArray)
+{
+    int n = arr.size();
+    int h = 0;
+    vector<int> rank(n), lcp(n);
+
+    for (int i = 0; i < suffixArray.size(); ++i)
+    {
+        rank[suffixArray[i]] = i;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (rank[i] > 0)
+        {
+            int j = suffixArray[rank[i] - 1];
+            while (i + h < n && j + h < n && arr[i + h] == arr[j + h])
+            {
+                ++h;
+            }
+            lcp[rank[i]] = h;
+            if (h > 0)
+            {
+                h -= 1;
+            }
+        }
+    }
+    return lcp;
+}
+// better checker
+int calculateResultingLength(const vector<int> &tokens, const vector<TokenInfo> &reverseDistinctTokens)
+{
+    if (tokens.size() == 0)
+    {
+        return 0;
+    }
+    int length = reverseDistinctTokens[tokens[0]].weight;
+    for (int i = 1; i < tokens.size(); ++i)
+    {
+        const TokenInfo &prev = reverseDistinctTokens[tokens[i - 1]];
+        const TokenInfo &cur = reverseDistinctTokens[tokens[i]];
+        if (!prev.isPP && !cur.isPP && !prev.isPunctuator && !cur.isPunctuator)
+        {
+            // !prev.isPP && !cur.isPP && !prev.isPunctuator && !cur.isPunctuator)
+            // means that we need a space between prev and cur
+            length += 1;
+        }
+        // and add cur's weight too
+        length += cur.weight;
+    }
+    return length;
+}
+vector<int> replaceOccurrences(vector<int> &source, vector<int> &part, int replacement)
+{
+    // compute pi for part
+    vector<int> pi(part.size(), 0);
+    for (int i = 1; i < part.size(); ++i)
+    {
+        int length = pi[i - 1];
+        while (length > 0 && part[i] != part[length])
+        {
+            length = pi[length - 1];
+        }
+        if (part[i] == part[length])
+        {
+            ++length;
+        }
+        pi[i] = length;
+    }
+    // now use that to match through source
+    vector<int> result;
+    int length = 0;
+    for (int i = 0; i < source.size(); ++i)
+    {
+        while (length > 0 && source[i] != part[length])
+        {
+            length = pi[length - 1];
+        }
+        if (source[i] == part[length])
+        {
+            ++length;
+        }
+
+        // check if it was a match
+        result.push_back(source[i]);
+        if (length == part.size())
+        {
+            // pop off part
+            for (int j = 0; j < part.size(); ++j)
+            {
+                result.pop_back();
+            }
+            length = 0;                    // reset to prevent overlap matches
+            result.push_back(replacement); // and push replacement
+        }
+    }
+    return result;
+}
+
+// a sequence of tokens that could be replaced by a define
+struct Candidate
+{
+    int length;   // resulting length of the tokens (and the new define) if this is committed
+    int orderKey; // tie breaker between candidates of equal length, smaller wins
+    vector<int> part;
+
+    bool operator<(const Candidate &other) const { return length != other.length ? length < other.length : orderKey < other.orderKey; }
+};
+
+/**
+ * @brief Collects the sequence of `length` tokens starting at `start`
+ *
+ * @return vector<int> the sequence, trimmed to have matched parentheses/brackets/braces when niceMacros is set.
+ *         Empty if there is no valid sequence
+ */
+vector<int> collectPart(vector<int> &tokens, const vector<TokenInfo> &reverseDistinctTokens, int start, int length, bool niceMacros)
+{
+    vector<int> part;
+    vector<bool> goodIncluding; // false after first negative
+    int parenCount = 0, bracketCount = 0, braceCount = 0;
+    bool matched = true;
+    for (int j = 0; j < length; ++j)
+    {
+        part.push_back(tokens[start + j]);
+
+        // match checking
+        if (reverseDistinctTokens[tokens[start + j]].spelling == "(")
+            ++parenCount;
+        else if (reverseDistinctTokens[tokens[start + j]].spelling == ")")
+            --parenCount;
+        else if (reverseDistinctTokens[tokens[start + j]].spelling == "[")
+            ++bracketCount;
+        else if (reverseDistinctTokens[tokens[start + j]].spelling == "]")
+            --bracketCount;
+        else if (reverseDistinctTokens[tokens[start + j]].spelling == "{")
+            ++braceCount;
+        else if (reverseDistinctTokens[tokens[start + j]].spelling == "}")
+            --braceCount;
+        if (parenCount < 0 || bracketCount < 0 || braceCount < 0)
+            matched = false;
+        goodIncluding.push_back(matched);
+    }
+    matched = matched && (parenCount == 0 && bracketCount == 0 && braceCount == 0);
+
+    // if we want to check for nice macros, check that and potentially skip this match
+    if (niceMacros && !matched)
+    {
+        // so it's not nice
+        // but it may be the only one of its kind that we'll check
+        // because the property of prefix of suffix means that we might be checking something like
+        // printf (
+        // and if we don't get rid of the trailing (, then we'll never end up replacing the printf part
+        // so thus try to remove trailing parentheses/brackets/braces
+        while (part.size() > 0 && (!goodIncluding[part.size() - 1] || !(parenCount == 0 && bracketCount == 0 && braceCount == 0)))
+        {
+            // pop off the last token
+            int num = part.back();
+            part.pop_back();
+            goodIncluding.pop_back();
+            // adjust counts
+            if (reverseDistinctTokens[num].spelling == "(")
+                --parenCount;
+            else if (reverseDistinctTokens[num].spelling == ")")
+                ++parenCount;
+            else if (reverseDistinctTokens[num].spelling == "[")
+                --bracketCount;
+            else if (reverseDistinctTokens[num].spelling == "]")
+                ++bracketCount;
+            else if (reverseDistinctTokens[num].spelling == "{")
+                --braceCount;
+            else if (reverseDistinctTokens[num].spelling == "}")
+                ++braceCount;
+        }
+    }
+    return part;
+}
+
+/**
+ * @brief Finds the most valuable sequences to replace with a define
+ *
+ * @param maxResults how many distinct candidates to keep
+ * @return vector<Candidate> up to maxResults candidates, best first
+ */
+vector<Candidate> mostValuableSubarrays(vector<int> &tokens, const vector<TokenInfo> &reverseDistinctTokens, int replacement, const DefineStrategy &strategy, int maxResults)
+{
+    int n = tokens.size();
+    vector<int> suffixArray = constructSuffixArray(tokens);
+    vector<int> lcpArray = constructLCPArray(tokens, suffixArray);
+
+    vector<Candidate> best;
+    for (int i = 1; i < n; ++i)
+    {
+        int length = lcpArray[i];
+        if (length == 0)
+        {
+            continue;
+        }
+
+        // collect part, checking for parentheses, brackets, and braces
+        vector<int> part = collectPart(tokens, reverseDistinctTokens, suffixArray[i], length, strategy.niceMacros);
+        if (part.size() == 0)
+        {
+            continue; // no valid match
+        }
+
+        // calculate length of resulting tokens
+        vector<int> resultingTokens = replaceOccurrences(tokens, part, replacement);
+        int resultingLength = calculateResultingLength(resultingTokens, reverseDistinctTokens);
+        // but also add the length from the define
+        // "#define " + replacement + " " + part + "\n"
+        resultingLength += DEFINE_WEIGHT + reverseDistinctTokens[replacement].weight + calculateResultingLength(part, reverseDistinctTokens);
+
+        int orderKey = i;
+        if (strategy.order == CandidateOrder::LongestFirst)
+            orderKey = -(int)part.size();
+        else if (strategy.order == CandidateOrder::ShortestFirst)
+            orderKey = part.size();
+        Candidate candidate{resultingLength, orderKey, std::move(part)};
+
+        // keep the best maxResults distinct candidates, sorted
+        auto existing = find_if(best.begin(), best.end(), [&candidate](const Candidate &c)
+                                { return c.part == candidate.part; });
+        if (existing != best.end())
+        {
+            if (!(candidate < *existing))
+            {
+                continue;
+            }
+            best.erase(existing);
+        }
+        else if (best.size() == maxResults && !(candidate < best.back()))
+        {
+            continue;
+        }
+        best.insert(upper_bound(best.begin(), best.end(), candidate), std::move(candidate));
+        if (best.size() > maxResults)
+        {
+            best.pop_back();
+        }
+    }
+    return best;
+}
+
+// what the sharded search needs to know about a token, readable from many threads at once
+struct TokenTraits
+{
+    int weight;
+    bool isPP;
+    bool isPunctuator;
+    bool isSemi;
+    signed char paren, bracket, brace; // +1 for an opener, -1 for a closer
+};
+
+vector<TokenTraits> computeTraits(const vector<TokenInfo> &reverseDistinctTokens)
+{
+    vector<TokenTraits> traits(reverseDistinctTokens.size());
+    for (int number = 0; number < reverseDistinctTokens.size(); ++number)
+    {
+        const TokenInfo &token = reverseDistinctTokens[number];
+        TokenTraits &t = traits[number];
+        t.weight = token.weight;
+        t.isPP = token.isPP;
+        t.isPunctuator = token.isPunctuator;
+        t.isSemi = !token.isPP && token.spelling == ";";
+        t.paren = token.spelling == "(" ? 1 : token.spelling == ")" ? -1 : 0;
+        t.bracket = token.spelling == "[" ? 1 : token.spelling == "]" ? -1 : 0;
+        t.brace = token.spelling == "{" ? 1 : token.spelling == "}" ? -1 : 0;
+    }
+    return traits;
+}
+
+// same as calculateResultingLength, but for tokens[start, start + length)
+int sequenceLength(const vector<int> &tokens, int start, int length, const vector<TokenTraits> &traits)
+{
+    int result = traits[tokens[start]].weight;
+    for (int i = start + 1; i < start + length; ++i)
+    {
+        const TokenTraits &prev = traits[tokens[i - 1]];
+        const TokenTraits &cur = traits[tokens[i]];
+        if (!prev.isPP && !cur.isPP && !prev.isPunctuator && !cur.isPunctuator)
+        {
+            result += 1;
+        }
+        result += cur.weight;
+    }
+    return result;
+}
+
+/**
+ * @brief Splits the tokens into top level declarations
+ *
+ * A declaration ends at a top level `;`, or at the `}` closing a function body.
+ * Preprocessor directives at top level are their own declaration.
+ *
+ * @return vector<pair<int, int>> the [begin, end) token ranges of each declaration
+ */
+vector<pair<int, int>> splitRegions(const vector<int> &tokens, const vector<TokenTraits> &traits)
+{
+    vector<pair<int, int>> regions;
+    int begin = 0;
+    int depth = 0;
+    bool functionBody = false; // whether the current top level braces belong to a function
+    for (int i = 0; i < tokens.size(); ++i)
+    {
+        const TokenTraits &t = traits[tokens[i]];
+        bool end = false;
+        if (t.isPP)
+        {
+            end = depth == 0;
+        }
+        else if (t.brace > 0)
+        {
+            if (depth == 0)
+            {
+                functionBody = i > 0 && traits[tokens[i - 1]].paren < 0;
+            }
+            ++depth;
+        }
+        else if (t.brace < 0)
+        {
+            depth = max(depth - 1, 0);
+            end = depth == 0 && functionBody;
+        }
+        else if (t.isSemi)
+        {
+            end = depth == 0;
+        }
+        if (end)
+        {
+            regions.push_back({begin, i + 1});
+            begin = i + 1;
+        }
+    }
+    if (begin < tokens.size())
+    {
+        regions.push_back({begin, (int)tokens.size()});
+    }
+    return regions;
+}
+
+// occurrences of one sequence, found while counting a shard
+struct SequenceCount
+{
+    int count;
+    int start; // where some occurrence starts
+    int length;
+};
+
+/**
+ * @brief Counts every sequence of at most SHARD_MAX_SEQUENCE tokens that starts
+ * inside tokens[begin, end) and ends before limit
+ *
+ * Sequences are keyed by a hash of their tokens. A collision only hurts the ranking,
+ * since candidates are checked against the real tokens before being committed.
+ */
+void countSequences(const vector<int> &tokens, int begin, int end, int limit, const vector<TokenTraits> &traits, bool niceMacros, DenseMap<uint64_t, SequenceCount> &counts)
+{
+    for (int i = begin; i < end; ++i)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        int parenCount = 0, bracketCount = 0, braceCount = 0;
+        for (int j = i; j < limit && j - i < SHARD_MAX_SEQUENCE; ++j)
+        {
+            const TokenTraits &t = traits[tokens[j]];
+            if (t.weight == 0)
+            {
+                break; // never worth replacing (preprocessor directives and main)
+            }
+            parenCount += t.paren;
+            bracketCount += t.bracket;
+            braceCount += t.brace;
+            if (niceMacros && (parenCount < 0 || bracketCount < 0 || braceCount < 0))
+            {
+                break; // every longer sequence has the same unmatched closer
+            }
+            hash = (hash ^ (uint64_t)tokens[j]) * 0x100000001b3ULL;
+            if (niceMacros && (parenCount != 0 || bracketCount != 0 || braceCount != 0))
+            {
+                continue;
+            }
+
+            // DenseMap reserves the two largest keys, so drop the top bit
+            auto [it, inserted] = counts.try_emplace(hash >> 1, SequenceCount{0, i, j - i + 1});
+            it->second.count++;
+        }
+    }
+}
+
+// every occurrence shrinks to the symbol, and the define costs its body once
+int estimatedSavings(int count, int partLength, int symbolWeight)
+{
+    return count * (partLength - symbolWeight) - (DEFINE_WEIGHT + symbolWeight + partLength);
+}
+
+/**
+ * @brief Streams the tokens with every occurrence of part replaced by replacement
+ *
+ * Same matching as replaceOccurrences, but instead of building the result, each
+ * resulting token is handed to emit as soon as it is known. Only the tokens of
+ * the current partial match are held back.
+ */
+template <typename Emit>
+void streamReplacement(const vector<int> &source, const vector<int> &part, int replacement, Emit emit)
+{
+    // compute pi for part
+    vector<int> pi(part.size(), 0);
+    for (int i = 1; i < part.size(); ++i)
+    {
+        int length = pi[i - 1];
+        while (length > 0 && part[i] != part[length])
+        {
+            length = pi[length - 1];
+        }
+        if (part[i] == part[length])
+        {
+            ++length;
+        }
+        pi[i] = length;
+    }
+
+    // the held back tokens are always the last `length` tokens read, which equal part[0, length)
+    int length = 0;
+    for (int i = 0; i < source.size(); ++i)
+    {
+        while (length > 0 && source[i] != part[length])
+        {
+            // the tokens that fell out of the partial match are final
+            int shorter = pi[length - 1];
+            for (int j = 0; j < length - shorter; ++j)
+            {
+                emit(part[j]);
+            }
+            length = shorter;
+        }
+        if (source[i] == part[length])
+        {
+            ++length;
+        }
+        else
+        {
+            emit(source[i]);
+        }
+
+        if (length == part.size())
+        {
+            emit(replacement);
+            length = 0; // reset to prevent overlap matches
+        }
+    }
+    for (int j = 0; j < length; ++j)
+    {
+        emit(part[j]);
+    }
+}
+
+// length calculateResultingLength would give after replacing part, without building the result
+int replacedLength(const vector<int> &tokens, const vector<int> &part, int replacement, const vector<TokenTraits> &traits)
+{
+    int length = 0;
+    const TokenTraits *prev = nullptr;
+    streamReplacement(tokens, part, replacement, [&](int tokenNumber)
+                      {
+                          const TokenTraits &cur = traits[tokenNumber];
+                          if (prev != nullptr && !prev->isPP && !cur.isPP && !prev->isPunctuator && !cur.isPunctuator)
+                          {
+                              length += 1;
+                          }
+                          length += cur.weight;
+                          prev = &cur; });
+    return length;
+}
+
+// replaces every occurrence of part, reusing the memory of tokens
+void replaceInPlace(vector<int> &tokens, const vector<int> &part, int replacement)
+{
+    // a replacement never makes the stream longer, so writes never overtake reads
+    int written = 0;
+    streamReplacement(tokens, part, replacement, [&](int tokenNumber)
+                      { tokens[written++] = tokenNumber; });
+    tokens.resize(written);
+}
+
+// little endian writer for checkpoints
+struct CheckpointWriter
+{
+    raw_ostream &out;
+
+    void u32(uint32_t value)
+    {
+        char buffer[4];
+        support::endian::write32le(buffer, value);
+        out.write(buffer, 4);
+    }
+    void u64(uint64_t value)
+    {
+        char buffer[8];
+        support::endian::write64le(buffer, value);
+        out.write(buffer, 8);
+    }
+    void str(StringRef value)
+    {
+        u32(value.size());
+        out << value;
+    }
+};
+
+// bounds checked reader for checkpoints, ok turns false on the first short read
+struct CheckpointReader
+{
+    StringRef data;
+    size_t pos = 0;
+    bool ok = true;
+
+    uint32_t u32()
+    {
+        if (!ok || pos + 4 > data.size())
+        {
+            ok = false;
+            return 0;
+        }
+        uint32_t value = support::endian::read32le(data.data() + pos);
+        pos += 4;
+        return value;
+    }
+    uint64_t u64()
+    {
+        if (!ok || pos + 8 > data.size())
+        {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = support::endian::read64le(data.data() + pos);
+        pos += 8;
+        return value;
+    }
+    string str()
+    {
+        uint32_t size = u32();
+        if (!ok || pos + size > data.size())
+        {
+            ok = false;
+            return "";
+        }
+        string value = data.substr(pos, size).str();
+        pos += size;
+        return value;
+    }
+};
+
+/**
+ * @brief Fingerprint of everything a checkpoint depends on
+ *
+ * A checkpoint is only resumed if the input, the strategy and the first symbol all match.
+ */
+uint64_t checkpointKey(StringRef input, const DefineStrategy &strategy, int firstUnusedSymbol)
+{
+    string key = input.str();
+    key += to_string(strategy.niceMacros) + to_string((int)strategy.order) + to_string(strategy.multiPick) + to_string(firstUnusedSymbol);
+    return xxHash64(key);
+}
+
+// the outcome of running one strategy to completion
+struct DefineResult
+{
+    int length; // estimated output length, defines included
+    vector<string> definesToAdd;
+    vector<int> tokenNumbers;
+    vector<TokenInfo> reverseDistinctTokens;
+    vector<shared_ptr<BumpPtrAllocator>> storage; // keeps the spellings alive
+};
+
+/**
+ * @brief Greedy define search for one strategy
+ *
+ */
+class DefineSearch
+{
+private:
+    TokenTable table; // own copy, since searches add tokens as they go
+    shared_ptr<BumpPtrAllocator> storage = make_shared<BumpPtrAllocator>(); // spellings of the tokens this search adds
+    DefineStrategy strategy;
+    vector<string> definesToAdd;
+    int definesLength = 0; // length of the defines committed so far
+
+    // the symbol the next define will use
+    int curUnusedSymbol;
+    int nextUnusedSymbol;
+    string curString;
+    int curSymbolToken;
+
+    // periodic checkpoints, disabled when checkpointPath is empty
+    string checkpointPath;
+    uint64_t checkpointKey = 0;
+    chrono::seconds checkpointInterval{0};
+
+    void allocateSymbol()
+    {
+        // names the file already uses, say from a header or because they weren't renamed, are skipped
+        pair<int, string> nextP = toSymbol(curUnusedSymbol, [this](StringRef name)
+                                           { return table.identifiers->contains(name); });
+        nextUnusedSymbol = nextP.first;
+        curString = nextP.second;
+        // use the table size, not curUnusedSymbol since curUnusedSymbol will be different and probably less
+        curSymbolToken = table.reverseDistinctTokens.size();
+        table.reverseDistinctTokens.push_back(TokenInfo(StringSaver(*storage).save(curString), false, false, curString.length()));
+    }
+
+    // replaces the sequence with the current symbol and moves on to the next symbol
+    void commit(const vector<int> &sequence, vector<int> &&editedTokenNumbers)
+    {
+        addDefine(sequence);
+        // update tokenNumbers; no point in waiting for a copy since we're just gonna discard editedTokenNumbers
+        table.tokenNumbers = std::move(editedTokenNumbers);
+        // now we can compute the next unused symbol
+        curUnusedSymbol = nextUnusedSymbol;
+        allocateSymbol();
+    }
+
+    // records the define of the current symbol, leaving the tokens alone
+    void addDefine(const vector<int> &sequence)
+    {
+        // add the definition at the top of the file
+        string defineString = "#define " + curString + " ";
+        for (int i = 0; i < sequence.size(); ++i)
+        {
+            defineString += table.reverseDistinctTokens[sequence[i]].spelling;
+            defineString += " ";
+        }
+        defineString += "\n";
+        definesToAdd.push_back(defineString);
+        definesLength += DEFINE_WEIGHT + table.reverseDistinctTokens[curSymbolToken].weight + calculateResultingLength(sequence, table.reverseDistinctTokens);
+    }
+
+    // commits the sequence if replacing it still makes the output shorter
+    bool tryCommit(vector<int> &part, int &curLength)
+    {
+        vector<int> editedTokenNumbers = replaceOccurrences(table.tokenNumbers, part, curSymbolToken);
+        int editedLength = calculateResultingLength(editedTokenNumbers, table.reverseDistinctTokens) +
+                           DEFINE_WEIGHT + table.reverseDistinctTokens[curSymbolToken].weight + calculateResultingLength(part, table.reverseDistinctTokens);
+        if (editedLength >= curLength)
+        {
+            return false;
+        }
+        commit(part, std::move(editedTokenNumbers));
+        curLength = calculateResultingLength(table.tokenNumbers, table.reverseDistinctTokens);
+        return true;
+    }
+
+    // replaces the sequence with the current symbol without copying the tokens,
+    // editedLength being what replacedLength measured for it
+    void commitInPlace(const vector<int> &sequence, int editedLength, int &curLength, vector<TokenTraits> &traits)
+    {
+        replaceInPlace(table.tokenNumbers, sequence, curSymbolToken);
+        addDefine(sequence);
+        curLength = editedLength;
+        curUnusedSymbol = nextUnusedSymbol;
+        allocateSymbol();
+
+        // the new define and symbol need traits too
+        traits = computeTraits(table.reverseDistinctTokens);
+    }
+
+    // packages up the result, publishing our length so that worse searches can stop early
+    optional<DefineResult> finish(int curLength, atomic<int> *bestLength)
+    {
+        int length = curLength + definesLength;
+        if (bestLength != nullptr)
+        {
+            int best = bestLength->load();
+            while (length < best && !bestLength->compare_exchange_weak(best, length))
+            {
+            }
+        }
+        return DefineResult{length, std::move(definesToAdd), std::move(table.tokenNumbers), std::move(table.reverseDistinctTokens), std::move(table.storage)};
+    }
+
+    // every distinct token still in the stream has to show up at least once in the output,
+    // either in the stream itself or in the body of some define, so no amount of further
+    // defines can bring the output below this
+    int lowerBound()
+    {
+        int bound = definesLength;
+        vector<bool> seen(table.reverseDistinctTokens.size(), false);
+        for (int tokenNumber : table.tokenNumbers)
+        {
+            if (!seen[tokenNumber])
+            {
+                seen[tokenNumber] = true;
+                bound += table.reverseDistinctTokens[tokenNumber].weight;
+            }
+        }
+        return bound;
+    }
+
+    // writes the state of the search, going through a temporary file so that
+    // being stopped mid-write never leaves a broken checkpoint behind, and a
+    // unique one so that runs sharing the checkpoint path never write into each other's
+    void saveCheckpoint()
+    {
+        int fd;
+        SmallString<128> tmpPath;
+        error_code ec = sys::fs::createUniqueFile(checkpointPath + "-%%%%%%.tmp", fd, tmpPath);
+        if (ec)
+        {
+            errs() << "Failed to write checkpoint " << checkpointPath << ": " << ec.message() << "\n";
+            return;
+        }
+        {
+            raw_fd_ostream out(fd, /*shouldClose=*/true);
+            CheckpointWriter writer{out};
+            writer.u32(CHECKPOINT_MAGIC);
+            writer.u64(checkpointKey);
+            writer.u32(table.reverseDistinctTokens.size());
+            writer.u32(curUnusedSymbol);
+            writer.u32(nextUnusedSymbol);
+            writer.u32(curSymbolToken);
+            writer.u32(definesLength);
+
+            // interned token table
+            writer.u32(table.reverseDistinctTokens.size());
+            for (int number = 0; number < table.reverseDistinctTokens.size(); ++number)
+            {
+                const TokenInfo &token = table.reverseDistinctTokens[number];
+                writer.u32(number);
+                writer.u32(token.isPP | token.isPunctuator << 1);
+                writer.u32(token.weight);
+                writer.str(token.spelling);
+            }
+
+            // committed defines and the token stream
+            writer.u32(definesToAdd.size());
+            for (string &define : definesToAdd)
+            {
+                writer.str(define);
+            }
+            writer.u32(table.tokenNumbers.size());
+            for (int tokenNumber : table.tokenNumbers)
+            {
+                writer.u32(tokenNumber);
+            }
+            out.close();
+            if (out.has_error())
+            {
+                ec = out.error();
+                out.clear_error();
+            }
+        }
+        if (ec || (ec = sys::fs::rename(tmpPath, checkpointPath)))
+        {
+            errs() << "Failed to write checkpoint " << checkpointPath << ": " << ec.message() << "\n";
+            sys::fs::remove(tmpPath);
+        }
+    }
+
+public:
+    DefineSearch(TokenTable table, const DefineStrategy &strategy, int firstUnusedSymbol) : table(std::move(table)), strategy(strategy), curUnusedSymbol(firstUnusedSymbol)
+    {
+        this->table.storage.push_back(storage);
+        // put the first unused symbol into known tokens
+        allocateSymbol();
+    }
+
+    /**
+     * @brief Makes the greedy search write its state to path every interval
+     *
+     * @param key the fingerprint from checkpointKey
+     */
+    void enableCheckpoints(const string &path, uint64_t key, chrono::seconds interval)
+    {
+        checkpointPath = path;
+        checkpointKey = key;
+        checkpointInterval = interval;
+    }
+
+    /**
+     * @brief Replaces the state of this search with the one in the checkpoint
+     *
+     * @return true if the checkpoint was loaded
+     * @return false if there is no usable checkpoint, in which case the search is unchanged
+     */
+    bool loadCheckpoint(const string &path, uint64_t key)
+    {
+        ErrorOr<unique_ptr<MemoryBuffer>> bufferOrErr = MemoryBuffer::getFile(path);
+        if (!bufferOrErr)
+        {
+            errs() << "No checkpoint at " << path << ", starting from scratch\n";
+            return false;
+        }
+        CheckpointReader reader{bufferOrErr.get()->getBuffer()};
+        if (reader.u32() != CHECKPOINT_MAGIC || reader.u64() != key)
+        {
+            errs() << "Checkpoint " << path << " is for a different input, starting from scratch\n";
+            return false;
+        }
+
+        TokenTable loaded;
+        loaded.storage.push_back(storage);
+        loaded.identifiers = table.identifiers; // the same input, so the same identifiers
+        StringSaver saver(*storage);
+        uint32_t loadedSize = reader.u32();
+        int loadedCurUnusedSymbol = reader.u32();
+        int loadedNextUnusedSymbol = reader.u32();
+        int loadedCurSymbolToken = reader.u32();
+        int loadedDefinesLength = reader.u32();
+        uint32_t numTokens = reader.u32();
+        for (uint32_t i = 0; i < numTokens && reader.ok; ++i)
+        {
+            uint32_t number = reader.u32();
+            uint32_t flags = reader.u32();
+            int weight = reader.u32();
+            StringRef spelling = saver.save(reader.str());
+            if (number != i)
+            {
+                reader.ok = false;
+            }
+            loaded.reverseDistinctTokens.push_back(TokenInfo(spelling, flags & 1, flags & 2, weight));
+        }
+        vector<string> loadedDefines(reader.u32());
+        for (string &define : loadedDefines)
+        {
+            define = reader.str();
+        }
+        uint32_t numTokenNumbers = reader.u32();
+        for (uint32_t i = 0; i < numTokenNumbers && reader.ok; ++i)
+        {
+            uint32_t tokenNumber = reader.u32();
+            if (tokenNumber >= numTokens)
+            {
+                reader.ok = false;
+            }
+            loaded.tokenNumbers.push_back(tokenNumber);
+        }
+        if (!reader.ok || loadedSize != numTokens || loadedCurSymbolToken < 0 || loadedCurSymbolToken >= numTokens)
+        {
+            errs() << "Checkpoint " << path << " is corrupt, starting from scratch\n";
+            return false;
+        }
+
+        table = std::move(loaded);
+        definesToAdd = std::move(loadedDefines);
+        definesLength = loadedDefinesLength;
+        curUnusedSymbol = loadedCurUnusedSymbol;
+        nextUnusedSymbol = loadedNextUnusedSymbol;
+        curSymbolToken = loadedCurSymbolToken;
+        curString = table.reverseDistinctTokens[curSymbolToken].spelling.str();
+        return true;
+    }
+
+    /**
+     * @brief Runs the greedy search to completion
+     *
+     * @param bestLength shared length of the best finished search, or nullptr if running alone.
+     *        The search gives up as soon as it can no longer match it
+     * @return optional<DefineResult> the result, or nothing if the search gave up
+     */
+    optional<DefineResult> runGreedy(atomic<int> *bestLength)
+    {
+        int maxResults = strategy.multiPick ? MULTI_PICK_CANDIDATES : 1;
+
+        // continuously replace the most valuable subarray while it's worth it
+        int curLength = calculateResultingLength(table.tokenNumbers, table.reverseDistinctTokens);
+        vector<Candidate> candidates = mostValuableSubarrays(table.tokenNumbers, table.reverseDistinctTokens, curSymbolToken, strategy, maxResults);
+        chrono::steady_clock::time_point lastCheckpoint = chrono::steady_clock::now();
+        while (candidates.size() > 0 && candidates.front().length < curLength)
+        {
+            // replace all instances of the best subarray with the replacement token
+            vector<int> editedTokenNumbers = replaceOccurrences(table.tokenNumbers, candidates.front().part, curSymbolToken);
+            commit(candidates.front().part, std::move(editedTokenNumbers));
+            curLength = calculateResultingLength(table.tokenNumbers, table.reverseDistinctTokens);
+
+            // the remaining candidates were scored against the old tokens,
+            // so only commit them if they still pay off
+            for (int i = 1; i < candidates.size(); ++i)
+            {
+                tryCommit(candidates[i].part, curLength);
+            }
+
+            // give up if some other search already finished with something we can't even tie.
+            // a tie may still win, since ties go to the earlier strategy whichever finished first
+            if (bestLength != nullptr && lowerBound() > bestLength->load())
+            {
+                return optional<DefineResult>();
+            }
+
+            // the state here is everything the rest of the loop depends on, so a search
+            // resumed from this checkpoint picks up exactly where this one is now
+            if (!checkpointPath.empty() && chrono::steady_clock::now() - lastCheckpoint >= checkpointInterval)
+            {
+                saveCheckpoint();
+                lastCheckpoint = chrono::steady_clock::now();
+            }
+
+            // and compute the next most valuable subarray
+            candidates = mostValuableSubarrays(table.tokenNumbers, table.reverseDistinctTokens, curSymbolToken, strategy, maxResults);
+        }
+        return finish(curLength, bestLength);
+    }
+
+    /**
+     * @brief Runs the sharded search to completion
+     *
+     * Each round splits the tokens into top level declarations and counts every short
+     * sequence inside each declaration in parallel. The per-shard counts are then merged
+     * in parallel, each thread owning a slice of the hash space, and the most promising
+     * merged candidates are committed one by one against the real tokens.
+     * Rounds repeat until one commits nothing, so longer repeats get built out of earlier defines.
+     *
+     * @param jobs max number of threads, 0 for one per hardware thread
+     * @return DefineResult
+     */
+    DefineResult runSharded(int jobs)
+    {
+        int numThreads = resolveJobs(jobs);
+        int curLength = calculateResultingLength(table.tokenNumbers, table.reverseDistinctTokens);
+        bool committed = true;
+        while (committed)
+        {
+            committed = false;
+            vector<int> &tokens = table.tokenNumbers;
+            vector<TokenTraits> traits = computeTraits(table.reverseDistinctTokens);
+
+            // group consecutive declarations into shards big enough to be worth a thread
+            vector<pair<int, int>> regions = splitRegions(tokens, traits);
+            vector<pair<int, int>> shards; // [first region, last region)
+            for (int r = 0; r < regions.size(); ++r)
+            {
+                if (shards.empty() || regions[shards.back().first].first + SHARD_MIN_TOKENS <= regions[r].first)
+                {
+                    shards.push_back({r, r});
+                }
+                shards.back().second = r + 1;
+            }
+
+            // count sequences within each declaration
+            vector<DenseMap<uint64_t, SequenceCount>> shardCounts(shards.size());
+            parallelFor(shards.size(), numThreads, [&](int s)
+                        {
+                            for (int r = shards[s].first; r < shards[s].second; ++r)
+                            {
+                                countSequences(tokens, regions[r].first, regions[r].second, regions[r].second, traits, strategy.niceMacros, shardCounts[s]);
+                            } });
+
+            // global reduction: thread p merges the keys that fall into its partition,
+            // then keeps its best candidates by estimated savings
+            int symbolWeight = table.reverseDistinctTokens[curSymbolToken].weight;
+            vector<vector<pair<int, SequenceCount>>> partitionBest(numThreads);
+            parallelFor(numThreads, numThreads, [&](int p)
+                        {
+                            DenseMap<uint64_t, SequenceCount> merged;
+                            for (DenseMap<uint64_t, SequenceCount> &counts : shardCounts)
+                            {
+                                for (auto &[key, count] : counts)
+                                {
+                                    if (key % numThreads != p)
+                                    {
+                                        continue;
+                                    }
+                                    auto [it, inserted] = merged.try_emplace(key, count);
+                                    if (!inserted)
+                                    {
+                                        it->second.count += count.count;
+                                    }
+                                }
+                            }
+                            vector<pair<int, SequenceCount>> &best = partitionBest[p];
+                            for (auto &[key, count] : merged)
+                            {
+                                if (count.count < 2)
+                                {
+                                    continue;
+                                }
+                                int partLength = sequenceLength(tokens, count.start, count.length, traits);
+                                int savings = estimatedSavings(count.count, partLength, symbolWeight);
+                                if (savings > 0)
+                                {
+                                    best.push_back({savings, count});
+                                }
+                            }
+                            std::sort(best.begin(), best.end(), [](const pair<int, SequenceCount> &a, const pair<int, SequenceCount> &b)
+                                 { return a.first > b.first; });
+                            if (best.size() > SHARD_CANDIDATES)
+                            {
+                                best.resize(SHARD_CANDIDATES);
+                            }
+                        });
+
+            // final global pass: commit the most promising candidates while they still pay off
+            vector<pair<int, vector<int>>> candidates;
+            for (vector<pair<int, SequenceCount>> &best : partitionBest)
+            {
+                for (auto &[savings, count] : best)
+                {
+                    candidates.push_back({savings, vector<int>(tokens.begin() + count.start, tokens.begin() + count.start + count.length)});
+                }
+            }
+            std::stable_sort(candidates.begin(), candidates.end(), [](const pair<int, vector<int>> &a, const pair<int, vector<int>> &b)
+                        { return a.first > b.first; });
+            if (candidates.size() > SHARD_CANDIDATES)
+            {
+                candidates.resize(SHARD_CANDIDATES);
+            }
+
+            // score a batch of candidates in parallel, then commit them in order. the scores only
+            // hold until something is committed, so the next batch starts right after each commit,
+            // which leaves the outcome exactly as if the candidates were checked one by one
+            vector<int> editedLengths(numThreads);
+            int next = 0;
+            while (next < candidates.size())
+            {
+                int batch = min<int>(numThreads, candidates.size() - next);
+                parallelFor(batch, numThreads, [&](int i)
+                            { editedLengths[i] = replacedLength(tokens, candidates[next + i].second, curSymbolToken, traits); });
+                for (int i = 0; i < batch; ++i)
+                {
+                    vector<int> &part = candidates[next++].second;
+                    int defineLength = DEFINE_WEIGHT + traits[curSymbolToken].weight + sequenceLength(part, 0, part.size(), traits);
+                    if (editedLengths[i] + defineLength < curLength)
+                    {
+                        commitInPlace(part, editedLengths[i], curLength, traits);
+                        committed = true;
+                        break;
+                    }
+                }
+            }
+        }
+        return *finish(curLength, nullptr);
+    }
+
+    /**
+     * @brief Runs the windowed search to completion
+     *
+     * Sequences are counted one window of start positions at a time, and each window's counts
+     * are merged into a global summary that gets pruned back to the WINDOW_SUMMARY most
+     * promising entries whenever it grows too big. The best candidates of the summary are
+     * then checked and applied in streaming passes that never copy the tokens.
+     * Besides one token number per token and the table of distinct tokens, memory only
+     * depends on the window size, as long as the search was given the only copy of the table.
+     *
+     * @param windowSize the number of start positions per window
+     * @return DefineResult
+     */
+    DefineResult runWindowed(int windowSize)
+    {
+        vector<int> &tokens = table.tokenNumbers;
+        if (tokens.empty())
+        {
+            return *finish(0, nullptr);
+        }
+        vector<TokenTraits> traits = computeTraits(table.reverseDistinctTokens);
+        int curLength = sequenceLength(tokens, 0, tokens.size(), traits);
+        bool committed = true;
+        while (committed)
+        {
+            committed = false;
+            int n = tokens.size();
+            int symbolWeight = table.reverseDistinctTokens[curSymbolToken].weight;
+            auto potential = [&](const SequenceCount &count)
+            {
+                return count.count * (sequenceLength(tokens, count.start, count.length, traits) - symbolWeight);
+            };
+
+            DenseMap<uint64_t, SequenceCount> summary;
+            for (int begin = 0; begin < n; begin += windowSize)
+            {
+                // sequences may run past the window, so nothing gets counted twice or missed
+                DenseMap<uint64_t, SequenceCount> window;
+                countSequences(tokens, begin, min(n, begin + windowSize), n, traits, strategy.niceMacros, window);
+                for (auto &[key, count] : window)
+                {
+                    auto [it, inserted] = summary.try_emplace(key, count);
+                    if (!inserted)
+                    {
+                        it->second.count += count.count;
+                    }
+                }
+
+                // keep the summary bounded by dropping the entries that are least likely to pay off
+                if (summary.size() > 2 * WINDOW_SUMMARY)
+                {
+                    vector<pair<int, uint64_t>> ranked;
+                    for (auto &[key, count] : summary)
+                    {
+                        ranked.push_back({potential(count), key});
+                    }
+                    std::nth_element(ranked.begin(), ranked.begin() + WINDOW_SUMMARY, ranked.end(), greater<pair<int, uint64_t>>());
+                    for (auto it = ranked.begin() + WINDOW_SUMMARY; it != ranked.end(); ++it)
+                    {
+                        summary.erase(it->second);
+                    }
+                }
+            }
+
+            // global top list
+            vector<pair<int, vector<int>>> candidates;
+            for (auto &[key, count] : summary)
+            {
+                int savings = estimatedSavings(count.count, sequenceLength(tokens, count.start, count.length, traits), symbolWeight);
+                if (count.count >= 2 && savings > 0)
+                {
+                    candidates.push_back({savings, vector<int>(tokens.begin() + count.start, tokens.begin() + count.start + count.length)});
+                }
+            }
+            summary.clear();
+            std::stable_sort(candidates.begin(), candidates.end(), [](const pair<int, vector<int>> &a, const pair<int, vector<int>> &b)
+                             { return a.first > b.first; });
+            if (candidates.size() > SHARD_CANDIDATES)
+            {
+                candidates.resize(SHARD_CANDIDATES);
+            }
+
+            // streaming passes: commit each candidate that still pays off
+            for (auto &[savings, part] : candidates)
+            {
+                int defineLength = DEFINE_WEIGHT + traits[curSymbolToken].weight + sequenceLength(part, 0, part.size(), traits);
+                int editedLength = replacedLength(tokens, part, curSymbolToken, traits);
+                if (editedLength + defineLength >= curLength)
+                {
+                    continue;
+                }
+                commitInPlace(part, editedLength, curLength, traits);
+                committed = true;
+            }
+        }
+        return *finish(curLength, nullptr);
+    }
+};
+
+void addDefines(StringRef code, int firstUnusedSymbol, const AddDefinesOptions &options, TokenStream *result)
+{
+    TokenTable table;
+    SourceTokens source;
+    {
+        // step 1 - lex the file into raw tokens;
+        TokenStream stream;
+        lexTokens(code, stream);
+        // the tokens in front of the defines are passed through as they are
+        uint32_t first = options.afterIncludes ? afterLastInclude(stream) : 0;
+        for (uint32_t i = 0; i < first; ++i)
+        {
+            const TokenStream::Entry &entry = stream.entries[i];
+            result->add(stream.spelling(entry), entry.kind, entry.flags, entry.offset);
+        }
+        // and convert the rest into distinct numbers. the stream's spellings live on in the table
+        tie(table, source) = getTokens(stream, first);
+    }
+
+    // run every strategy, using as many threads as we are allowed
+    const vector<DefineStrategy> &strategies = options.strategies;
+    vector<optional<DefineResult>> results(strategies.size());
+    if (options.windowSize > 0)
+    {
+        // only the search's copy of the table is kept, so memory stays bounded
+        results[0] = DefineSearch(std::move(table), strategies[0], firstUnusedSymbol).runWindowed(options.windowSize);
+    }
+    else if (options.sharded)
+    {
+        results[0] = DefineSearch(std::move(table), strategies[0], firstUnusedSymbol).runSharded(options.jobs);
+    }
+    else if (strategies.size() == 1)
+    {
+        DefineSearch search(std::move(table), strategies[0], firstUnusedSymbol);
+        if (!options.checkpointPath.empty())
+        {
+            uint64_t key = checkpointKey(code, strategies[0], firstUnusedSymbol);
+            if (options.resume)
+            {
+                search.loadCheckpoint(options.checkpointPath, key);
+            }
+            search.enableCheckpoints(options.checkpointPath, key, chrono::seconds(options.checkpointInterval));
+        }
+        results[0] = search.runGreedy(nullptr);
+        if (!options.checkpointPath.empty())
+        {
+            sys::fs::remove(options.checkpointPath); // finished, nothing left to resume
+        }
+    }
+    else
+    {
+        atomic<int> bestLength = numeric_limits<int>::max();
+        parallelFor(strategies.size(), options.jobs, [&](int i)
+                    { results[i] = DefineSearch(table, strategies[i], firstUnusedSymbol).runGreedy(&bestLength); });
+    }
+
+    // keep the smallest result; ties go to the earlier strategy
+    optional<DefineResult> *winner = nullptr;
+    for (optional<DefineResult> &result : results)
+    {
+        if (result && (winner == nullptr || result->length < (*winner)->length))
+        {
+            winner = &result;
+        }
+    }
+    DefineResult &best = **winner; // the best search can never be cancelled
+
+    // convert back into tokens, which are only turned into text once every stage is done
+    for (string &define : best.definesToAdd)
+    {
+        lexTokens(define, *result, false);
+    }
+    bool startOfLine = true; // the first token, and the ones after preprocessor lines
+    for (int tokenNumber : best.tokenNumbers)
+    {
+        const TokenInfo &token = best.reverseDistinctTokens[tokenNumber];
+        if (token.isPP)
+        {
+            // preprocessor lines come from the source, so copy the tokens of the first one spelled like this
+            auto [first, count] = source.ppLineRanges[tokenNumber];
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                const TokenStream::Entry &entry = source.ppLines.entries[i];
+                result->add(source.ppLines.spelling(entry), entry.kind, entry.flags, entry.offset);
+            }
+            startOfLine = true;
+            continue;
+        }
+
+        // the tokens that aren't from the source are the symbols the search added
+        tok::TokenKind kind = tokenNumber < source.kinds.size() ? source.kinds[tokenNumber] : tok::raw_identifier;
+        uint8_t flags = TokenStream::LeadingSpace;
+        flags |= token.isPunctuator ? TokenStream::Punctuator : 0;
+        flags |= startOfLine ? TokenStream::StartOfLine : 0;
+        result->add(token.spelling, kind, flags);
+        startOfLine = false;
+    }
+}
+
+vector<DefineStrategy> definePortfolio(bool allowUnbalanced)
+{
+    vector<DefineStrategy> result = {
+        DefineStrategy(true, CandidateOrder::SuffixOrder, false), // the default
+        DefineStrategy(true, CandidateOrder::LongestFirst, false),
+        DefineStrategy(true, CandidateOrder::ShortestFirst, false),
+        DefineStrategy(true, CandidateOrder::SuffixOrder, true),
+        DefineStrategy(true, CandidateOrder::LongestFirst, true),
+    };
+    if (allowUnbalanced)
+    {
+        result.push_back(DefineStrategy(false, CandidateOrder::SuffixOrder, false));
+        result.push_back(DefineStrategy(false, CandidateOrder::LongestFirst, false));
+        result.push_back(DefineStrategy(false, CandidateOrder::SuffixOrder, true));
+    }
+    return result;
+}
@@ -0,0 +1,1071 @@
+#include <util/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FORMAT_X86 1
+#endif
+
+using namespace std;
+using namespace llvm;
+
+// what each of 64 bytes is, one bit per byte
+struct BlockMasks
+{
+    uint64_t whitespace; // ' ', '\t', '\n', '\v', '\f', '\r'
+    uint64_t newline;    // '\n', '\r'
+    uint64_t identifier; // letters, digits, '_'
+    uint64_t digit;      // '0' to '9'
+    uint64_t dot;        // '.'
+    uint64_t sign;       // '+', '-'
+    uint64_t special;    // anything that can start a comment, literal or directive, or that the block path can't space
+};
+
+// the kinds of runs the scanner skips over in bulk. each is given the
+// first byte it may look at and the first byte past the run it may not,
+// and may read up to 32 bytes past that. classify reads exactly 64 bytes,
+// and compact reads 64 bytes and may write up to 72
+struct ScanFunctions
+{
+    const char *(*findAny)(const char *p, const char *end, const char needles[4]); // first of the needles
+    const char *(*skipBlanks)(const char *p, const char *end);                      // first that isn't ' ' or '\t'
+    const char *(*skipIdentifier)(const char *p, const char *end);                  // first that can't continue an identifier
+    void (*classify)(const char *p, BlockMasks &masks);
+    char *(*compact)(const char *p, uint64_t keep, char *out); // the bytes whose bit is set, with whitespace as ' '
+};
+
+// the bytes the block path leaves to the scanner: quotes, comments, directives,
+// backslashes, and whatever isn't plain ascii
+bool isSpecialChar(unsigned char c)
+{
+    return c == '"' || c == '\'' || c == '/' || c == '\\' || c == '#' || c == '$' || c == '@' || c == '`' ||
+           (c < 0x20 && !(c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r')) || c >= 0x7f;
+}
+
+// the identifier characters the block path handles
+bool isPlainIdentifierChar(unsigned char c)
+{
+    return (c | 0x20) - 'a' < 26u || c - '0' < 10u || c == '_';
+}
+
+// identifiers may hold letters, digits, '_', '$' and anything outside of ascii
+bool isIdentifierChar(unsigned char c)
+{
+    return (c | 0x20) - 'a' < 26u || c - '0' < 10u || c == '_' || c == '$' || c >= 0x80;
+}
+
+const char *findAnyScalar(const char *p, const char *end, const char needles[4])
+{
+    for (; p < end; ++p)
+    {
+        if (*p == needles[0] || *p == needles[1] || *p == needles[2] || *p == needles[3])
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+const char *skipBlanksScalar(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        ++p;
+    }
+    return p;
+}
+
+const char *skipIdentifierScalar(const char *p, const char *end)
+{
+    while (p < end && isIdentifierChar(*p))
+    {
+        ++p;
+    }
+    return p;
+}
+
+// what classify looks up. the vector paths split each byte into its row (high nibble)
+// and column (low nibble), and look both up separately
+static const struct ClassTables
+{
+    enum : uint8_t
+    {
+        WHITESPACE = 1,
+        NEWLINE = 2,
+        IDENTIFIER = 4,
+        DIGIT = 8,
+        DOT = 16,
+        SIGN = 32,
+        SPECIAL = 64
+    };
+    uint8_t classes[256] = {};
+    // per column, the one character of the set in it, or 0xff, which no ascii character matches
+    alignas(16) uint8_t whitespace[16];
+    alignas(16) uint8_t newline[16];
+    // per column, a bit for each row that completes a character of the set
+    alignas(16) uint8_t identifierRows[16] = {};
+    alignas(16) uint8_t specialRows[16] = {};
+    // the bit for each row, and none outside of ascii
+    alignas(16) uint8_t rowBits[16] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+    ClassTables()
+    {
+        memset(whitespace, 0xff, sizeof whitespace);
+        memset(newline, 0xff, sizeof newline);
+        for (int c = 0; c < 256; ++c)
+        {
+            bool isNewline = c == '\n' || c == '\r';
+            bool isWhitespace = c == ' ' || c == '\t' || c == '\v' || c == '\f' || isNewline;
+            classes[c] = (isWhitespace ? WHITESPACE : 0) | (isNewline ? NEWLINE : 0) |
+                         (isPlainIdentifierChar(c) ? IDENTIFIER : 0) | (c - '0' < 10u ? DIGIT : 0) |
+                         (c == '.' ? DOT : 0) | (c == '+' || c == '-' ? SIGN : 0) | (isSpecialChar(c) ? SPECIAL : 0);
+            if (c >= 0x80)
+            {
+                continue;
+            }
+            whitespace[c & 15] = isWhitespace ? c : whitespace[c & 15];
+            newline[c & 15] = isNewline ? c : newline[c & 15];
+            identifierRows[c & 15] |= isPlainIdentifierChar(c) ? 1 << (c >> 4) : 0;
+            specialRows[c & 15] |= isSpecialChar(c) ? 1 << (c >> 4) : 0;
+        }
+    }
+} classTables;
+
+// looks up 8 bytes at a time, and gathers each class's bits with a multiply,
+// which moves bit 0 of byte i to bit 56 + i without carries
+void classifyScalar(const char *p, BlockMasks &masks)
+{
+    masks = BlockMasks{};
+    for (int i = 0; i < 64; i += 8)
+    {
+        uint64_t classes = 0;
+        for (int j = 0; j < 8; ++j)
+        {
+            classes |= (uint64_t)classTables.classes[(unsigned char)p[i + j]] << (8 * j);
+        }
+        auto gather = [&](int bit)
+        {
+            return ((classes >> bit & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56 << i;
+        };
+        masks.whitespace |= gather(0);
+        masks.newline |= gather(1);
+        masks.identifier |= gather(2);
+        masks.digit |= gather(3);
+        masks.dot |= gather(4);
+        masks.sign |= gather(5);
+        masks.special |= gather(6);
+    }
+}
+
+// the block path only keeps whitespace where it becomes a space, and nothing
+// else it keeps is below ' ', so max turns exactly the whitespace into spaces
+char *compactScalar(const char *p, uint64_t keep, char *out)
+{
+    for (int i = 0; i < 64; ++i)
+    {
+        *out = max(p[i], ' ');
+        out += keep >> i & 1;
+    }
+    return out;
+}
+
+#ifdef FORMAT_X86
+// for each 8 bit mask, the shuffle that moves the bytes whose bit is set to the front
+static const struct CompactShuffles
+{
+    uint64_t shuffles[256];
+    CompactShuffles()
+    {
+        for (int mask = 0; mask < 256; ++mask)
+        {
+            uint64_t shuffle = 0;
+            int length = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                if (mask >> i & 1)
+                {
+                    shuffle |= (uint64_t)i << (8 * length++);
+                }
+            }
+            shuffles[mask] = shuffle;
+        }
+    }
+} compactShuffles;
+
+// 8 bytes at a time, since pshufb takes its indices from a table that size allows
+__attribute__((target("sse4.2"))) char *compactSSE42(const char *p, uint64_t keep, char *out)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    for (int i = 0; i < 64; i += 8)
+    {
+        unsigned bits = keep >> i & 0xff;
+        __m128i v = _mm_max_epu8(_mm_loadl_epi64((const __m128i *)(p + i)), space);
+        __m128i shuffle = _mm_loadl_epi64((const __m128i *)&compactShuffles.shuffles[bits]);
+        _mm_storel_epi64((__m128i *)out, _mm_shuffle_epi8(v, shuffle));
+        out += __builtin_popcount(bits);
+    }
+    return out;
+}
+
+__attribute__((target("sse4.2"))) const char *findAnySSE42(const char *p, const char *end, const char needles[4])
+{
+    const __m128i set = _mm_setr_epi8(needles[0], needles[1], needles[2], needles[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; p < end; p += 16)
+    {
+        int index = _mm_cmpestri(set, 4, _mm_loadu_si128((const __m128i *)p), 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+        {
+            return min(p + index, end);
+        }
+    }
+    return end;
+}
+
+__attribute__((target("sse4.2"))) const char *skipBlanksSSE42(const char *p, const char *end)
+{
+    const __m128i set = _mm_setr_epi8(' ', '\t', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; p < end; p += 16)
+    {
+        int index = _mm_cmpestri(set, 2, _mm_loadu_si128((const __m128i *)p), 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+        {
+            return min(p + index, end);
+        }
+    }
+    return end;
+}
+
+__attribute__((target("sse4.2"))) const char *skipIdentifierSSE42(const char *p, const char *end)
+{
+    const __m128i ranges = _mm_setr_epi8('a', 'z', 'A', 'Z', '0', '9', '_', '_', '$', '$', (char)0x80, (char)0xff, 0, 0, 0, 0);
+    for (; p < end; p += 16)
+    {
+        int index = _mm_cmpestri(ranges, 12, _mm_loadu_si128((const __m128i *)p), 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+        {
+            return min(p + index, end);
+        }
+    }
+    return end;
+}
+
+// unlike the other SSE4.2 functions, this needs nothing past SSSE3
+__attribute__((target("sse4.2"))) void classifySSE42(const char *p, BlockMasks &masks)
+{
+    const __m128i whitespaceChars = _mm_load_si128((const __m128i *)classTables.whitespace);
+    const __m128i newlineChars = _mm_load_si128((const __m128i *)classTables.newline);
+    const __m128i identifierRows = _mm_load_si128((const __m128i *)classTables.identifierRows);
+    const __m128i specialRows = _mm_load_si128((const __m128i *)classTables.specialRows);
+    const __m128i rowBits = _mm_load_si128((const __m128i *)classTables.rowBits);
+    const __m128i nibble = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+    BlockMasks found{};
+    for (int i = 0; i < 64; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        // pshufb gives 0 for bytes outside of ascii, which neither matches them nor has row bits
+        __m128i column = _mm_and_si128(v, nibble);
+        __m128i row = _mm_shuffle_epi8(rowBits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i whitespace = _mm_cmpeq_epi8(_mm_shuffle_epi8(whitespaceChars, v), v);
+        __m128i newline = _mm_cmpeq_epi8(_mm_shuffle_epi8(newlineChars, v), v);
+        __m128i notIdentifier = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(identifierRows, column), row), zero);
+        __m128i notSpecial = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(specialRows, column), row), zero);
+        __m128i fromZero = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(fromZero, _mm_set1_epi8(9)), fromZero);
+        __m128i sign = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')), _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+        found.whitespace |= (uint64_t)_mm_movemask_epi8(whitespace) << i;
+        found.newline |= (uint64_t)_mm_movemask_epi8(newline) << i;
+        found.identifier |= (uint64_t)(uint16_t)~_mm_movemask_epi8(notIdentifier) << i;
+        found.digit |= (uint64_t)_mm_movemask_epi8(digit) << i;
+        found.dot |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.'))) << i;
+        found.sign |= (uint64_t)_mm_movemask_epi8(sign) << i;
+        // bytes outside of ascii have their top bit set, which is all movemask looks at
+        found.special |= (uint64_t)(uint16_t)(~_mm_movemask_epi8(notSpecial) | _mm_movemask_epi8(v)) << i;
+    }
+    masks = found;
+}
+
+__attribute__((target("avx2"))) const char *findAnyAVX2(const char *p, const char *end, const char needles[4])
+{
+    const __m256i a = _mm256_set1_epi8(needles[0]), b = _mm256_set1_epi8(needles[1]);
+    const __m256i c = _mm256_set1_epi8(needles[2]), d = _mm256_set1_epi8(needles[3]);
+    for (; p < end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i found = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, b)),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, c), _mm256_cmpeq_epi8(v, d)));
+        unsigned mask = _mm256_movemask_epi8(found);
+        if (mask != 0)
+        {
+            return min(p + __builtin_ctz(mask), end);
+        }
+    }
+    return end;
+}
+
+__attribute__((target("avx2"))) const char *skipBlanksAVX2(const char *p, const char *end)
+{
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    for (; p < end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)));
+        if (mask != 0)
+        {
+            return min(p + __builtin_ctz(mask), end);
+        }
+    }
+    return end;
+}
+
+// x <= limit, unsigned
+__attribute__((target("avx2"))) inline __m256i atMost(__m256i x, __m256i limit)
+{
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, limit), x);
+}
+
+__attribute__((target("avx2"))) const char *skipIdentifierAVX2(const char *p, const char *end)
+{
+    const __m256i lowerBit = _mm256_set1_epi8(0x20), a = _mm256_set1_epi8('a'), zero = _mm256_set1_epi8('0');
+    const __m256i letters = _mm256_set1_epi8(25), digits = _mm256_set1_epi8(9);
+    const __m256i underscore = _mm256_set1_epi8('_'), dollar = _mm256_set1_epi8('$');
+    for (; p < end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i letter = atMost(_mm256_sub_epi8(_mm256_or_si256(v, lowerBit), a), letters);
+        __m256i digit = atMost(_mm256_sub_epi8(v, zero), digits);
+        __m256i symbol = _mm256_or_si256(_mm256_cmpeq_epi8(v, underscore), _mm256_cmpeq_epi8(v, dollar));
+        // bytes outside of ascii have their top bit set, which is all movemask looks at
+        unsigned inside = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(letter, digit), _mm256_or_si256(symbol, v)));
+        if (~inside != 0)
+        {
+            return min(p + __builtin_ctz(~inside), end);
+        }
+    }
+    return end;
+}
+
+__attribute__((target("avx2"))) inline uint32_t bitsAVX2(__m256i m)
+{
+    return _mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2"))) inline __m256i tableAVX2(const uint8_t table[16])
+{
+    return _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)table));
+}
+
+// the same as classifySSE42, 32 bytes at a time
+__attribute__((target("avx2"))) void classifyAVX2(const char *p, BlockMasks &masks)
+{
+    const __m256i whitespaceChars = tableAVX2(classTables.whitespace), newlineChars = tableAVX2(classTables.newline);
+    const __m256i identifierRows = tableAVX2(classTables.identifierRows), specialRows = tableAVX2(classTables.specialRows);
+    const __m256i rowBits = tableAVX2(classTables.rowBits);
+    const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+    BlockMasks found{};
+    for (int i = 0; i < 64; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i column = _mm256_and_si256(v, nibble);
+        __m256i row = _mm256_shuffle_epi8(rowBits, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i whitespace = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(whitespaceChars, v), v);
+        __m256i newline = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(newlineChars, v), v);
+        __m256i notIdentifier = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(identifierRows, column), row), zero);
+        __m256i notSpecial = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(specialRows, column), row), zero);
+        __m256i digit = atMost(_mm256_sub_epi8(v, _mm256_set1_epi8('0')), _mm256_set1_epi8(9));
+        __m256i sign = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+        found.whitespace |= (uint64_t)bitsAVX2(whitespace) << i;
+        found.newline |= (uint64_t)bitsAVX2(newline) << i;
+        found.identifier |= (uint64_t)~bitsAVX2(notIdentifier) << i;
+        found.digit |= (uint64_t)bitsAVX2(digit) << i;
+        found.dot |= (uint64_t)bitsAVX2(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'))) << i;
+        found.sign |= (uint64_t)bitsAVX2(sign) << i;
+        found.special |= (uint64_t)(~bitsAVX2(notSpecial) | bitsAVX2(v)) << i;
+    }
+    masks = found;
+}
+#endif
+
+bool formatPathSupported(FormatPath path)
+{
+    switch (path)
+    {
+    case FormatPath::Detect:
+    case FormatPath::Scalar:
+        return true;
+#ifdef FORMAT_X86
+    case FormatPath::SSE42:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    case FormatPath::AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const ScanFunctions &scanFunctions(FormatPath path)
+{
+    static const ScanFunctions scalar{findAnyScalar, skipBlanksScalar, skipIdentifierScalar, classifyScalar, compactScalar};
+#ifdef FORMAT_X86
+    // pshufb compacts 8 bytes at a time either way, which is already cheaper than classifying
+    static const ScanFunctions sse42{findAnySSE42, skipBlanksSSE42, skipIdentifierSSE42, classifySSE42, compactSSE42};
+    static const ScanFunctions avx2{findAnyAVX2, skipBlanksAVX2, skipIdentifierAVX2, classifyAVX2, compactSSE42};
+    if (path == FormatPath::Detect)
+    {
+        path = formatPathSupported(FormatPath::AVX2) ? FormatPath::AVX2 : formatPathSupported(FormatPath::SSE42) ? FormatPath::SSE42
+                                                                                                                 : FormatPath::Scalar;
+    }
+    if (path == FormatPath::AVX2)
+    {
+        return avx2;
+    }
+    if (path == FormatPath::SSE42)
+    {
+        return sse42;
+    }
+#endif
+    return scalar;
+}
+
+// how many bytes of a backslash-newline start at p, 0 if there isn't one there.
+// like clang, whitespace is allowed between the backslash and the newline
+size_t spliceLength(const char *p)
+{
+    if (*p != '\\')
+    {
+        return 0;
+    }
+    size_t length = 1;
+    while (length < 16 && (p[length] == ' ' || p[length] == '\t' || p[length] == '\f' || p[length] == '\v'))
+    {
+        ++length;
+    }
+    if (p[length] == '\n')
+    {
+        return length + 1;
+    }
+    if (p[length] == '\r')
+    {
+        return length + (p[length + 1] == '\n' ? 2 : 1);
+    }
+    return 0;
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// the characters that make up the punctuators FormatAction knows about. a punctuator
+// is never spaced from what is around it, so each character can be written on its own
+bool isPunctuatorChar(char c)
+{
+    static const struct Table
+    {
+        bool punctuator[256] = {};
+        Table()
+        {
+            for (const char *c = "[](){}.&*+-~!/%<>^|?:;=,#"; *c; ++c)
+            {
+                punctuator[(unsigned char)*c] = true;
+            }
+        }
+    } table;
+    return table.punctuator[(unsigned char)c];
+}
+
+// whether an identifier or number followed by c ends there, the way the block path can
+// tell. '.', '+' and '-' may continue a number, and the scanner decides about the rest
+bool endsNumber(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f' ||
+           (isPunctuatorChar(c) && c != '.' && c != '+' && c != '-');
+}
+
+// collects the output in a fixed size buffer, since most writes are a byte or two
+class OutputBuffer
+{
+private:
+    static const size_t SIZE = 1 << 16;
+    raw_ostream &out;
+    unique_ptr<char[]> buffer = make_unique<char[]>(SIZE);
+    size_t used = 0;
+
+public:
+    OutputBuffer(raw_ostream &out) : out(out) {}
+    void put(char c)
+    {
+        if (used == SIZE)
+        {
+            flush();
+        }
+        buffer[used++] = c;
+    }
+    // room for at least length bytes at the end of the output, to be filled in and then committed
+    char *reserve(size_t length)
+    {
+        if (SIZE - used < length)
+        {
+            flush();
+        }
+        return buffer.get() + used;
+    }
+    void commit(char *end)
+    {
+        used = end - buffer.get();
+    }
+    void write(const char *p, size_t length)
+    {
+        if (length > SIZE - used)
+        {
+            flush();
+            if (length > SIZE)
+            {
+                out.write(p, length);
+                return;
+            }
+        }
+        memcpy(buffer.get() + used, p, length);
+        used += length;
+    }
+    void flush()
+    {
+        out.write(buffer.get(), used);
+        used = 0;
+    }
+};
+
+// FormatAction's spacing rules, applied while scanning instead of on clang's tokens.
+// tokens are written out as soon as they start, so no token is ever held in memory
+class FormatScanner
+{
+private:
+    enum class State
+    {
+        Between,      // whitespace, or the start of the next token
+        Identifier,   // inside an identifier
+        Number,       // inside a preprocessing number
+        Literal,      // inside a string or character literal
+        LineComment,  // inside a // comment
+        BlockComment, // inside a /* */ comment
+    };
+
+    OutputBuffer out;
+    const ScanFunctions &scan;
+    State state = State::Between;
+    const char *dataEnd = nullptr; // past the last byte of input read so far
+    char quote = 0;         // what ends the current literal
+    char prevNumberChar = 0; // the last character of the current number
+    bool commentStar = false; // the last byte scanned of the current block comment was a '*' that can close it
+
+    // the 64 bytes the block path last classified, which it works through before classifying more
+    const char *window = nullptr;
+    BlockMasks masks;
+
+    // spacing state, see FormatAction::ExecuteAction
+    bool atBOF = true;
+    bool lastPunctuator = false;
+    bool startOfLine = true; // no token yet on the current line
+    bool gap = false;        // whitespace or comments since the last token
+    bool wasPP = false;      // inside a preprocessor line
+    int defineState = 0;     // the last tokens were 1: '#' starting a line, 2: then define, 3: then an identifier
+
+    // the current token
+    bool curHashAtStart = false;
+    bool curIdentifier = false;
+    int defineMatched = 0; // how much of "define" the current identifier matches, -1 once it doesn't
+
+    void beginToken(bool punctuator, bool hash)
+    {
+        bool isFirstPP = hash && startOfLine;
+        if (atBOF)
+        {
+            // no spaces between start of file and first token
+        }
+        else if (isFirstPP || (wasPP && startOfLine))
+        {
+            if (wasPP && startOfLine)
+            {
+                wasPP = false;
+            }
+            out.put('\n');
+        }
+        else if (lastPunctuator || punctuator)
+        {
+            // '#', 'define', (some identifier), then a punctuator after some space
+            // keeps one space, so a function-like macro doesn't become one
+            if (wasPP && defineState == 3 && gap)
+            {
+                out.put(' ');
+            }
+        }
+        else
+        {
+            out.put(' ');
+        }
+        wasPP = wasPP || isFirstPP;
+        lastPunctuator = punctuator;
+        atBOF = false;
+        startOfLine = false;
+        gap = false;
+        curHashAtStart = isFirstPP;
+        curIdentifier = false;
+    }
+
+    void endToken()
+    {
+        if (curHashAtStart)
+        {
+            defineState = 1;
+        }
+        else if (curIdentifier && defineState == 1 && defineMatched == 6)
+        {
+            defineState = 2;
+        }
+        else if (curIdentifier && defineState == 2)
+        {
+            defineState = 3;
+        }
+        else
+        {
+            defineState = 0;
+        }
+    }
+
+    void singleToken(const char *p, size_t length, bool punctuator, bool hash = false)
+    {
+        beginToken(punctuator, hash);
+        out.write(p, length);
+        endToken();
+    }
+
+    void matchDefine(const char *p, const char *end)
+    {
+        static const char define[] = "define";
+        for (; p < end && defineMatched >= 0; ++p)
+        {
+            defineMatched = defineMatched < 6 && *p == define[defineMatched] ? defineMatched + 1 : -1;
+        }
+    }
+
+    // handles whatever starts at p, returning where to continue
+    const char *scanBetween(const char *p, const char *limit)
+    {
+        char c = *p;
+        if (c == ' ' || c == '\t')
+        {
+            gap = true;
+            return scan.skipBlanks(p + 1, limit);
+        }
+        switch (c)
+        {
+        case '\n':
+        case '\r':
+            gap = true;
+            startOfLine = true;
+            return p + 1;
+        case '\f':
+        case '\v':
+        case '\0':
+            gap = true;
+            return p + 1;
+        case '\\':
+            if (size_t length = spliceLength(p))
+            {
+                gap = true;
+                return p + length;
+            }
+            singleToken(p, 1, false);
+            return p + 1;
+        case '/':
+            // like clang without line comments, //* is a slash and then a block comment
+            if (p[1] == '/' && p[2] != '*')
+            {
+                gap = true;
+                state = State::LineComment;
+                return p + 2;
+            }
+            if (p[1] == '*')
+            {
+                gap = true;
+                state = State::BlockComment;
+                commentStar = false; // the '*' of the opening doesn't count, /*/ is still open
+                return p + 2;
+            }
+            singleToken(p, 1, true);
+            return p + 1;
+        case '#':
+            if (p[1] == '#')
+            {
+                // ## isn't one of the punctuators
+                singleToken(p, 2, false);
+                return p + 2;
+            }
+            singleToken(p, 1, true, true);
+            return p + 1;
+        case '.':
+            if (!isDigit(p[1]))
+            {
+                singleToken(p, 1, true);
+                return p + 1;
+            }
+            break;
+        case '"':
+        case '\'':
+            beginToken(false, false);
+            out.put(c);
+            quote = c;
+            state = State::Literal;
+            return p + 1;
+        case 'L':
+            if (p[1] == '"' || p[1] == '\'')
+            {
+                beginToken(false, false);
+                out.write(p, 2);
+                quote = p[1];
+                state = State::Literal;
+                return p + 2;
+            }
+            break;
+        }
+
+        if (isDigit(c) || c == '.')
+        {
+            beginToken(false, false);
+            out.put(c);
+            prevNumberChar = c;
+            state = State::Number;
+            return p + 1;
+        }
+        if (isIdentifierChar(c))
+        {
+            beginToken(false, false);
+            curIdentifier = true;
+            defineMatched = 0;
+            state = State::Identifier;
+            return p;
+        }
+        singleToken(p, 1, isPunctuatorChar(c));
+        return p + 1;
+    }
+
+    // bits i and up
+    static uint64_t bitsFrom(int i)
+    {
+        return i >= 64 ? 0 : ~0ull << i;
+    }
+
+    // the first n bytes of a classified block, which hold nothing special and end between tokens.
+    // such code only needs its whitespace dropped, with one space kept where an identifier or
+    // number would otherwise run into the one before it. the rest of beginToken only matters
+    // at the start of a preprocessor line, which run leaves to the scanner. end is past the
+    // rest of an identifier that runs on from byte n for up to 16 bytes, or p + n
+    const char *scanBlock(const char *p, int n, const char *end)
+    {
+        int offset = p - window;
+        uint64_t valid = bitsFrom(n) ^ ~0ull;
+        uint64_t whitespace = masks.whitespace >> offset & valid;
+        uint64_t newline = masks.newline >> offset & valid;
+        uint64_t kept = ~whitespace & valid;
+        if (kept == 0)
+        {
+            gap = true;
+            startOfLine = startOfLine || newline != 0;
+            return p + n;
+        }
+        uint64_t identifiers = kept & masks.identifier >> offset;
+        int first = __builtin_ctzll(kept);
+        int last = 63 - __builtin_clzll(kept);
+
+        // the token before the block decides on the space before the first one in it
+        char *o = out.reserve(1 + 72 + 16);
+        *o = ' ';
+        o += !atBOF && !lastPunctuator && (identifiers >> first & 1);
+        // adding the first byte of a whitespace run that follows an identifier carries through the
+        // whole run, which then turns into a space at its last byte if an identifier follows it too
+        uint64_t afterIdentifier = (identifiers << 1) & whitespace;
+        uint64_t runs = ((whitespace + afterIdentifier) ^ whitespace) & whitespace;
+        uint64_t spaces = runs & ~(whitespace >> 1) & (identifiers >> 1);
+        o = scan.compact(p, kept | spaces, o);
+        memcpy(o, p + n, 16);
+        out.commit(o + (end - (p + n)));
+
+        lastPunctuator = !(identifiers >> last & 1);
+        atBOF = false;
+        defineState = 0;
+        gap = last < n - 1;
+        startOfLine = (newline & bitsFrom(last + 1)) != 0;
+        return end;
+    }
+
+    const char *scanIdentifier(const char *p, const char *limit)
+    {
+        const char *end = scan.skipIdentifier(p, limit);
+        matchDefine(p, end);
+        out.write(p, end - p);
+        if (end >= limit)
+        {
+            return end;
+        }
+        if (size_t length = spliceLength(end))
+        {
+            // tokens are written without their line splices
+            return end + length;
+        }
+        endToken();
+        state = State::Between;
+        return end;
+    }
+
+    const char *scanNumber(const char *p, const char *limit)
+    {
+        const char *end = p;
+        while (end < limit)
+        {
+            char c = *end;
+            bool exponentSign = (c == '+' || c == '-') && (prevNumberChar == 'e' || prevNumberChar == 'E' || prevNumberChar == 'p' || prevNumberChar == 'P');
+            if (!exponentSign && c != '.' && (c == '$' || !isIdentifierChar(c)))
+            {
+                break;
+            }
+            prevNumberChar = c;
+            ++end;
+        }
+        out.write(p, end - p);
+        if (end >= limit)
+        {
+            return end;
+        }
+        if (size_t length = spliceLength(end))
+        {
+            return end + length;
+        }
+        endToken();
+        state = State::Between;
+        return end;
+    }
+
+    const char *scanLiteral(const char *p, const char *limit)
+    {
+        const char needles[4] = {quote, '\\', '\n', '\r'};
+        const char *end = scan.findAny(p, limit, needles);
+        out.write(p, end - p);
+        if (end >= limit)
+        {
+            return end;
+        }
+        if (*end == quote)
+        {
+            out.put(quote);
+            endToken();
+            state = State::Between;
+            return end + 1;
+        }
+        if (*end == '\\')
+        {
+            if (size_t length = spliceLength(end))
+            {
+                return end + length;
+            }
+            // an escape
+            size_t length = min<size_t>(2, dataEnd - end);
+            out.write(end, length);
+            return end + length;
+        }
+        // unterminated, clang ends the token at the newline
+        endToken();
+        state = State::Between;
+        return end;
+    }
+
+    const char *scanLineComment(const char *p, const char *limit)
+    {
+        const char needles[4] = {'\n', '\r', '\\', '\n'};
+        const char *end = scan.findAny(p, limit, needles);
+        if (end >= limit)
+        {
+            return end;
+        }
+        if (*end == '\\')
+        {
+            // a backslash-newline continues the comment onto the next line
+            return end + max<size_t>(spliceLength(end), 1);
+        }
+        state = State::Between;
+        return end;
+    }
+
+    const char *scanBlockComment(const char *p, const char *limit)
+    {
+        // comments are full of '*' but have few '/', so look for the end of "*/"
+        const char needles[4] = {'/', '/', '/', '/'};
+        const char *end = scan.findAny(p, limit, needles);
+        if (end >= limit)
+        {
+            // the input may stop between the two
+            commentStar = end > p ? end[-1] == '*' : commentStar;
+            return end;
+        }
+        if (end > p ? end[-1] == '*' : commentStar)
+        {
+            state = State::Between;
+            return end + 1;
+        }
+        commentStar = false;
+        return end + 1;
+    }
+
+public:
+    FormatScanner(raw_ostream &out, FormatPath path) : out(out), scan(scanFunctions(path)) {}
+
+    // writes out whatever is still buffered
+    void flush()
+    {
+        out.flush();
+    }
+
+    /**
+     * @brief Scans [p, limit), where at least LOOKAHEAD bytes after limit may be read
+     *
+     * @param dataEnd past the last byte of input, limit unless more input follows
+     * @return const char* where to continue, which may be a little past limit
+     */
+    // the end of the identifier or number that carries on at p, if it's made of letters, digits
+    // and '_' and ends within a few bytes with something that can't continue it
+    static const char *identifierTail(const char *p)
+    {
+        const char *end = p;
+        while (end < p + 16 && isPlainIdentifierChar(*end))
+        {
+            ++end;
+        }
+        return endsNumber(*end) ? end : nullptr;
+    }
+
+    // classifies the 64 bytes from p, which start between tokens, for the block path. special
+    // then also holds what the block path can't tell apart from the rest without looking ahead
+    void classifyWindow(const char *p)
+    {
+        window = p;
+        scan.classify(p, masks);
+        // a dot only matters when it starts a number, and a dot or sign only when it continues one.
+        // adding the first digit of each number carries through the rest of it
+        uint64_t numberStarts = masks.digit & ~(masks.identifier << 1);
+        uint64_t numbers = ((masks.identifier + numberStarts) ^ masks.identifier) & masks.identifier;
+        masks.special |= (masks.dot & ((masks.digit >> 1) | (uint64_t)isDigit(p[64]) << 63)) |
+                         ((masks.dot | masks.sign) & (numbers << 1));
+    }
+
+    const char *run(const char *p, const char *limit, const char *dataEnd)
+    {
+        this->dataEnd = dataEnd;
+        window = nullptr; // the input may have moved since
+        while (p < limit)
+        {
+            // the block path takes everything up to the next thing it can't handle, after which
+            // the scanner takes over until it's between tokens again. a preprocessor line's first
+            // tokens decide on the spacing of the rest, so they're left to the scanner
+            if (state == State::Between && (!wasPP || (defineState == 0 && !startOfLine)))
+            {
+                if ((window == nullptr || p - window >= 64) && limit - p >= 64)
+                {
+                    classifyWindow(p);
+                }
+                if (window != nullptr && p - window < 64)
+                {
+                    int offset = p - window;
+                    int length = 64 - offset;
+                    // the end of the line ends a directive
+                    uint64_t special = (masks.special | (wasPP ? masks.newline : 0)) >> offset;
+                    uint64_t identifier = masks.identifier >> offset;
+                    int n = special != 0 ? __builtin_ctzll(special) : length;
+                    const char *tail = nullptr;
+                    // stop before an identifier or number that may carry on past n, unless
+                    // it runs on past the window and plainly ends soon after
+                    if (n > 0 && (identifier >> (n - 1) & 1) && (n < length ? !(masks.whitespace >> offset >> n & 1) : (tail = identifierTail(window + 64)) == nullptr))
+                    {
+                        uint64_t notIdentifier = ~identifier & (bitsFrom(n) ^ ~0ull);
+                        n = notIdentifier != 0 ? 64 - __builtin_clzll(notIdentifier) : 0;
+                    }
+                    if (n > 0)
+                    {
+                        p = scanBlock(p, n, tail != nullptr ? tail : p + n);
+                        continue;
+                    }
+                }
+            }
+            switch (state)
+            {
+            case State::Between:
+                p = scanBetween(p, limit);
+                break;
+            case State::Identifier:
+                p = scanIdentifier(p, limit);
+                break;
+            case State::Number:
+                p = scanNumber(p, limit);
+                break;
+            case State::Literal:
+                p = scanLiteral(p, limit);
+                break;
+            case State::LineComment:
+                p = scanLineComment(p, limit);
+                break;
+            case State::BlockComment:
+                p = scanBlockComment(p, limit);
+                break;
+            }
+        }
+        return p;
+    }
+};
+
+const size_t BLOCK_SIZE = 1 << 20;
+// how far past the scanned part the scanner may look, and the SIMD loads may read
+const size_t LOOKAHEAD = 64;
+
+bool formatStream(FILE *in, raw_ostream &out, FormatPath path)
+{
+    unique_ptr<char[]> buffer = make_unique<char[]>(BLOCK_SIZE + LOOKAHEAD);
+    FormatScanner scanner(out, path);
+    size_t filled = 0;
+    size_t pos = 0;
+    bool atEOF = false;
+    while (true)
+    {
+        // keep the unscanned tail and read the next block after it
+        if (!atEOF)
+        {
+            memmove(buffer.get(), buffer.get() + pos, filled - pos);
+            filled -= pos;
+            pos = 0;
+            while (!atEOF && filled < BLOCK_SIZE)
+            {
+                size_t read = fread(buffer.get() + filled, 1, BLOCK_SIZE - filled, in);
+                filled += read;
+                if (read == 0)
+                {
+                    if (ferror(in))
+                    {
+                        return false;
+                    }
+                    atEOF = true;
+                }
+            }
+            // nothing past the input may look like part of a token
+            memset(buffer.get() + filled, 0, LOOKAHEAD);
+        }
+
+        size_t limit = atEOF ? filled : filled - LOOKAHEAD;
+        pos = scanner.run(buffer.get() + pos, buffer.get() + limit, buffer.get() + filled) - buffer.get();
+        if (atEOF)
+        {
+            scanner.flush();
+            return true;
+        }
+    }
+}
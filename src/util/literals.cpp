@@ -0,0 +1,221 @@
+#include <util/literals.hpp>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Error.h>
+#include <cctype>
+#include <cstring>
+#include <optional>
+
+using namespace std;
+using namespace llvm;
+
+// whether value fits in a type of the given width
+bool fits(uint64_t value, unsigned width, bool isSigned)
+{
+    unsigned bits = isSigned ? width - 1 : width;
+    return bits >= 64 || value <= (UINT64_MAX >> (64 - bits));
+}
+
+// the type C gives an integer literal: the first of the candidates the value fits in
+optional<IntegerType> literalType(uint64_t value, bool decimal, bool isUnsigned, int longs, const IntegerWidths &widths)
+{
+    struct Candidate
+    {
+        IntegerType type;
+        unsigned width;
+        bool isSigned;
+        int longs;
+    };
+    const Candidate candidates[] = {
+        {IntegerType::Int, widths.intWidth, true, 0},
+        {IntegerType::UnsignedInt, widths.intWidth, false, 0},
+        {IntegerType::Long, widths.longWidth, true, 1},
+        {IntegerType::UnsignedLong, widths.longWidth, false, 1},
+        {IntegerType::LongLong, widths.longLongWidth, true, 2},
+        {IntegerType::UnsignedLongLong, widths.longLongWidth, false, 2},
+    };
+    for (const Candidate &candidate : candidates)
+    {
+        // a suffix sets the smallest rank and whether it's unsigned. unsuffixed
+        // decimal literals are only ever signed, the others may be either
+        if (candidate.longs < longs ||
+            (isUnsigned && candidate.isSigned) ||
+            (!isUnsigned && decimal && !candidate.isSigned))
+        {
+            continue;
+        }
+        if (fits(value, candidate.width, candidate.isSigned))
+        {
+            return candidate.type;
+        }
+    }
+    return nullopt;
+}
+
+string toBase(uint64_t value, unsigned base)
+{
+    string digits;
+    do
+    {
+        digits += "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0);
+    return string(digits.rbegin(), digits.rend());
+}
+
+string shortestIntegerLiteral(uint64_t value, IntegerType type, const IntegerWidths &widths)
+{
+    struct Base
+    {
+        string digits;
+        bool decimal;
+    };
+    const Base bases[] = {{toBase(value, 10), true}, {"0" + toBase(value, 8), false}, {"0x" + toBase(value, 16), false}};
+
+    string best;
+    for (const Base &base : bases)
+    {
+        for (bool isUnsigned : {false, true})
+        {
+            for (int longs = 0; longs <= 2; ++longs)
+            {
+                optional<IntegerType> candidate = literalType(value, base.decimal, isUnsigned, longs, widths);
+                if (candidate != type)
+                {
+                    continue;
+                }
+                string spelling = base.digits + (isUnsigned ? "u" : "") + string(longs, 'l');
+                if (spelling.back() == 'e')
+                {
+                    // a following + or - would become part of the same pp-number
+                    continue;
+                }
+                if (best.empty() || spelling.size() < best.size())
+                {
+                    best = spelling;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+string shortestCharacterLiteral(uint32_t value, bool integerAllowed)
+{
+    unsigned char c = value & 0xff;
+    if (value != c && value != (uint32_t)(int32_t)(signed char)c)
+    {
+        // more than one character
+        return "";
+    }
+
+    string best;
+    if (c == '\'' || c == '\\')
+    {
+        best = string("'\\") + (char)c + "'";
+    }
+    else if (c >= 0x20 && c < 0x7f)
+    {
+        best = string("'") + (char)c + "'";
+    }
+    else
+    {
+        const char *escapes = "\a\b\f\n\r\t\v";
+        const char *letters = "abfnrtv";
+        const char *escape = c == 0 ? nullptr : strchr(escapes, c);
+        best = escape ? string("'\\") + letters[escape - escapes] + "'" : "'\\" + toBase(c, 8) + "'";
+    }
+
+    // a decimal int only stands in for values that don't depend on char being signed
+    if (integerAllowed && value == c && to_string(c).size() < best.size())
+    {
+        best = to_string(c);
+    }
+    return best;
+}
+
+// the spellings of digits * 10^exponent, with or without an exponent
+string shortestSpelling(const string &digits, int exponent)
+{
+    string positional;
+    int length = digits.size();
+    if (exponent >= 0)
+    {
+        positional = digits + string(exponent, '0') + ".";
+    }
+    else if (-exponent < length)
+    {
+        positional = digits.substr(0, length + exponent) + "." + digits.substr(length + exponent);
+    }
+    else
+    {
+        positional = "." + string(-exponent - length, '0') + digits;
+    }
+
+    // the point can go anywhere in the digits, but leaving it out is always shortest
+    string scientific = digits + "e" + to_string(exponent);
+    return scientific.size() < positional.size() ? scientific : positional;
+}
+
+string shortestFloatingLiteral(const APFloat &value, const string &suffix)
+{
+    if (value.isZero())
+    {
+        return "0." + suffix;
+    }
+    if (!value.isFiniteNonZero() || value.isNegative())
+    {
+        return "";
+    }
+
+    // the fewest significant digits that still read back as the same value
+    for (unsigned precision = 1; precision <= 64; ++precision)
+    {
+        SmallString<64> text;
+        value.toString(text, precision, 0, false);
+
+        // the text is scientific, d.dddE+x
+        string digits;
+        int exponent = 0;
+        size_t e = text.find_first_of("eE");
+        for (size_t i = 0; i < text.size() && i < e; ++i)
+        {
+            if (isdigit((unsigned char)text[i]))
+            {
+                digits += text[i];
+            }
+            else if (text[i] == '.')
+            {
+                exponent = -(int)(e - i - 1);
+            }
+        }
+        if (e != StringRef::npos)
+        {
+            exponent += stoi(text.substr(e + 1).str());
+        }
+        while (digits.size() > 1 && digits.back() == '0')
+        {
+            digits.pop_back();
+            ++exponent;
+        }
+        size_t leading = digits.find_first_not_of('0');
+        if (leading == string::npos)
+        {
+            continue;
+        }
+        digits = digits.substr(leading);
+
+        string spelling = shortestSpelling(digits, exponent);
+        APFloat parsed(value.getSemantics());
+        Expected<APFloat::opStatus> status = parsed.convertFromString(spelling, APFloat::rmNearestTiesToEven);
+        if (!status)
+        {
+            consumeError(status.takeError());
+            continue;
+        }
+        if (parsed.bitwiseIsEqual(value))
+        {
+            return spelling + suffix;
+        }
+    }
+    return "";
+}
@@ -0,0 +1,495 @@
+#include <util/macrocache.hpp>
+#include <clang/Basic/LangOptions.h>
+#include <clang/Lex/Lexer.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+using namespace clang;
+using namespace llvm;
+using namespace llvm::support;
+
+// layout, all little endian:
+//   header:  magic, version, record count, unused (u32 each), strings offset, lists offset (u64 each)
+//   records: sorted by fingerprint and then path, RECORD_SIZE bytes each
+//            fingerprint (u64), path (u32 string offset, u32 length), size (u64), mtime (i64),
+//            names, includes and tested names (u32 list index, u32 count each)
+//   lists:   a string offset and length (u32 each) per list item
+//   strings: the bytes of every string, each stored once
+const uint32_t CACHE_MAGIC = 0x49434e4d; // "MNCI"
+const uint32_t CACHE_VERSION = 2;
+const size_t HEADER_SIZE = 32;
+const size_t RECORD_SIZE = 56;
+const size_t ITEM_SIZE = 8;
+
+enum RecordField
+{
+    NAMES = 32,
+    INCLUDES = 40,
+    TESTED = 48,
+};
+
+// the names in the directives of code: the macro each #define defines, or every identifier
+// the conditionals test. raw lexing doesn't know which branches are live, so every directive counts
+vector<string> directiveNames(StringRef code, bool conditionals)
+{
+    LangOptions lo;
+    Lexer lexer(SourceLocation(), lo, code.begin(), code.begin(), code.end());
+    vector<string> names;
+
+    Token tok;
+    lexer.LexFromRawLexer(tok);
+    while (!tok.is(tok::eof))
+    {
+        if (!tok.is(tok::hash) || !tok.isAtStartOfLine())
+        {
+            lexer.LexFromRawLexer(tok);
+            continue;
+        }
+        lexer.LexFromRawLexer(tok);
+        if (!tok.is(tok::raw_identifier) || tok.isAtStartOfLine())
+        {
+            continue;
+        }
+        StringRef directive = tok.getRawIdentifier();
+        bool isConditional = directive == "if" || directive == "ifdef" || directive == "ifndef" ||
+                             directive == "elif" || directive == "elifdef" || directive == "elifndef";
+        if (conditionals ? !isConditional : directive != "define")
+        {
+            continue;
+        }
+        lexer.LexFromRawLexer(tok);
+        while (!tok.is(tok::eof) && !tok.isAtStartOfLine())
+        {
+            if (tok.is(tok::raw_identifier) && tok.getRawIdentifier() != "defined")
+            {
+                names.push_back(tok.getRawIdentifier().str());
+            }
+            if (!conditionals)
+            {
+                // only the name of a #define, not its body
+                break;
+            }
+            lexer.LexFromRawLexer(tok);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+vector<string> definedMacroNames(StringRef code)
+{
+    return directiveNames(code, false);
+}
+
+vector<string> testedMacroNames(StringRef code)
+{
+    return directiveNames(code, true);
+}
+
+MacroNameCache::MacroNameCache(string path) : path(std::move(path))
+{
+    auto file = MemoryBuffer::getFile(this->path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!file)
+    {
+        return;
+    }
+    buffer = std::move(*file);
+    if (!validate())
+    {
+        // a broken cache is rebuilt from scratch
+        buffer.reset();
+        count = 0;
+    }
+}
+
+bool MacroNameCache::validate()
+{
+    StringRef data = buffer->getBuffer();
+    if (data.size() < HEADER_SIZE ||
+        endian::read32le(data.data()) != CACHE_MAGIC ||
+        endian::read32le(data.data() + 4) != CACHE_VERSION)
+    {
+        return false;
+    }
+    count = endian::read32le(data.data() + 8);
+    listsOffset = endian::read64le(data.data() + 24);
+    stringsOffset = endian::read64le(data.data() + 16);
+    if (listsOffset != HEADER_SIZE + count * RECORD_SIZE ||
+        stringsOffset < listsOffset || stringsOffset > data.size() ||
+        (stringsOffset - listsOffset) % ITEM_SIZE != 0)
+    {
+        return false;
+    }
+
+    // check every offset once, so lookups can trust them
+    uint64_t items = (stringsOffset - listsOffset) / ITEM_SIZE;
+    uint64_t strings = data.size() - stringsOffset;
+    for (uint64_t i = 0; i < items; ++i)
+    {
+        const char *item = data.data() + listsOffset + i * ITEM_SIZE;
+        if ((uint64_t)endian::read32le(item) + endian::read32le(item + 4) > strings)
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *record = recordAt(i);
+        if ((uint64_t)endian::read32le(record + 8) + endian::read32le(record + 12) > strings)
+        {
+            return false;
+        }
+        for (int field : {NAMES, INCLUDES, TESTED})
+        {
+            if ((uint64_t)endian::read32le(record + field) + endian::read32le(record + field + 4) > items)
+            {
+                return false;
+            }
+        }
+        if (i > 0 && make_pair(fingerprintOf(i - 1), pathOf(i - 1)) >= make_pair(fingerprintOf(i), pathOf(i)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *MacroNameCache::recordAt(size_t i) const
+{
+    return buffer->getBufferStart() + HEADER_SIZE + i * RECORD_SIZE;
+}
+
+uint64_t MacroNameCache::fingerprintOf(size_t i) const
+{
+    return endian::read64le(recordAt(i));
+}
+
+StringRef MacroNameCache::pathOf(size_t i) const
+{
+    const char *record = recordAt(i);
+    return StringRef(buffer->getBufferStart() + stringsOffset + endian::read32le(record + 8),
+                     endian::read32le(record + 12));
+}
+
+StringRef MacroNameCache::listString(uint32_t index) const
+{
+    const char *item = buffer->getBufferStart() + listsOffset + (uint64_t)index * ITEM_SIZE;
+    return StringRef(buffer->getBufferStart() + stringsOffset + endian::read32le(item),
+                     endian::read32le(item + 4));
+}
+
+void MacroNameCache::listOf(size_t i, int field, vector<StringRef> &out) const
+{
+    const char *record = recordAt(i);
+    uint32_t index = endian::read32le(record + field);
+    uint32_t length = endian::read32le(record + field + 4);
+    for (uint32_t j = 0; j < length; ++j)
+    {
+        out.push_back(listString(index + j));
+    }
+}
+
+void MacroNameCache::setFingerprint(uint64_t fingerprint)
+{
+    this->fingerprint = fingerprint;
+    // records are sorted by fingerprint first, so a configuration's records are together
+    size_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (fingerprintOf(mid) < fingerprint)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    first = last = lo;
+    while (last < count && fingerprintOf(last) == fingerprint)
+    {
+        ++last;
+    }
+}
+
+vector<StringRef> MacroNameCache::headers() const
+{
+    vector<StringRef> paths;
+    for (size_t i = first; i < last; ++i)
+    {
+        paths.push_back(pathOf(i));
+    }
+    return paths;
+}
+
+int MacroNameCache::find(StringRef path) const
+{
+    size_t lo = first, hi = last;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pathOf(mid) < path)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo < last && pathOf(lo) == path ? (int)lo : -1;
+}
+
+bool MacroNameCache::readStatus(Header &header)
+{
+    sys::fs::file_status status;
+    if (sys::fs::status(header.path, status))
+    {
+        return false;
+    }
+    header.size = status.getSize();
+    header.mtime = status.getLastModificationTime().time_since_epoch().count();
+    return true;
+}
+
+bool MacroNameCache::isUnchanged(size_t i)
+{
+    StringRef path = pathOf(i);
+    auto it = fresh.find(path);
+    if (it != fresh.end())
+    {
+        return it->second;
+    }
+    Header current;
+    current.path = path.str();
+    const char *record = recordAt(i);
+    bool unchanged = readStatus(current) &&
+                     current.size == endian::read64le(record + 16) &&
+                     current.mtime == (int64_t)endian::read64le(record + 24);
+    fresh[path] = unchanged;
+    return unchanged;
+}
+
+bool MacroNameCache::isFresh(StringRef path)
+{
+    // every header it can reach has to be recorded and unchanged
+    vector<StringRef> stack{path};
+    StringSet<> seen{path};
+    while (!stack.empty())
+    {
+        StringRef header = stack.back();
+        stack.pop_back();
+        int i = find(header);
+        if (i < 0 || !isUnchanged(i))
+        {
+            return false;
+        }
+        vector<StringRef> includes;
+        listOf(i, INCLUDES, includes);
+        for (StringRef include : includes)
+        {
+            if (seen.insert(include).second)
+            {
+                stack.push_back(include);
+            }
+        }
+    }
+    return true;
+}
+
+void MacroNameCache::addNames(StringRef path, StringSet<> &names, StringSet<> &tested)
+{
+    vector<StringRef> stack;
+    if (added.insert(path).second)
+    {
+        stack.push_back(path);
+    }
+    vector<StringRef> list;
+    while (!stack.empty())
+    {
+        int i = find(stack.back());
+        stack.pop_back();
+        if (i < 0)
+        {
+            continue;
+        }
+        list.clear();
+        listOf(i, NAMES, list);
+        for (StringRef name : list)
+        {
+            names.insert(name);
+        }
+        list.clear();
+        listOf(i, TESTED, list);
+        for (StringRef name : list)
+        {
+            tested.insert(name);
+        }
+        list.clear();
+        listOf(i, INCLUDES, list);
+        for (StringRef include : list)
+        {
+            if (added.insert(include).second)
+            {
+                stack.push_back(include);
+            }
+        }
+    }
+}
+
+void MacroNameCache::record(Header header)
+{
+    recorded.push_back(std::move(header));
+}
+
+MacroNameCache::Header MacroNameCache::read(size_t i) const
+{
+    Header header;
+    const char *record = recordAt(i);
+    header.path = pathOf(i).str();
+    header.size = endian::read64le(record + 16);
+    header.mtime = (int64_t)endian::read64le(record + 24);
+    vector<StringRef> list;
+    listOf(i, NAMES, list);
+    for (StringRef name : list)
+    {
+        header.names.push_back(name.str());
+    }
+    list.clear();
+    listOf(i, INCLUDES, list);
+    for (StringRef include : list)
+    {
+        header.includes.push_back(include.str());
+    }
+    list.clear();
+    listOf(i, TESTED, list);
+    for (StringRef name : list)
+    {
+        header.tested.push_back(name.str());
+    }
+    return header;
+}
+
+bool MacroNameCache::save()
+{
+    // this run's records win, then the mapped ones that are still worth keeping
+    vector<pair<uint64_t, Header>> records;
+    StringSet<> replaced;
+    for (Header &header : recorded)
+    {
+        if (replaced.insert(header.path).second)
+        {
+            records.emplace_back(fingerprint, std::move(header));
+        }
+    }
+    recorded.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (fingerprintOf(i) == fingerprint)
+        {
+            if (replaced.contains(pathOf(i)))
+            {
+                continue;
+            }
+            auto it = fresh.find(pathOf(i));
+            if (it != fresh.end() && !it->second)
+            {
+                // known to be stale
+                continue;
+            }
+        }
+        records.emplace_back(fingerprintOf(i), read(i));
+    }
+    std::sort(records.begin(), records.end(), [](const pair<uint64_t, Header> &a, const pair<uint64_t, Header> &b)
+         { return make_pair(a.first, StringRef(a.second.path)) < make_pair(b.first, StringRef(b.second.path)); });
+
+    string strings;
+    StringMap<uint32_t> stringOffsets;
+    auto addString = [&](const string &s, string &out)
+    {
+        auto inserted = stringOffsets.try_emplace(s, strings.size());
+        if (inserted.second)
+        {
+            strings += s;
+        }
+        char item[ITEM_SIZE];
+        endian::write32le(item, inserted.first->second);
+        endian::write32le(item + 4, s.size());
+        out.append(item, ITEM_SIZE);
+    };
+
+    string table, lists;
+    for (const auto &[recordFingerprint, header] : records)
+    {
+        char record[RECORD_SIZE];
+        string path;
+        addString(header.path, path);
+        endian::write64le(record, recordFingerprint);
+        memcpy(record + 8, path.data(), ITEM_SIZE);
+        endian::write64le(record + 16, header.size);
+        endian::write64le(record + 24, (uint64_t)header.mtime);
+        endian::write32le(record + NAMES, lists.size() / ITEM_SIZE);
+        endian::write32le(record + NAMES + 4, header.names.size());
+        for (const string &name : header.names)
+        {
+            addString(name, lists);
+        }
+        endian::write32le(record + INCLUDES, lists.size() / ITEM_SIZE);
+        endian::write32le(record + INCLUDES + 4, header.includes.size());
+        for (const string &include : header.includes)
+        {
+            addString(include, lists);
+        }
+        endian::write32le(record + TESTED, lists.size() / ITEM_SIZE);
+        endian::write32le(record + TESTED + 4, header.tested.size());
+        for (const string &name : header.tested)
+        {
+            addString(name, lists);
+        }
+        table.append(record, RECORD_SIZE);
+    }
+
+    char head[HEADER_SIZE] = {};
+    endian::write32le(head, CACHE_MAGIC);
+    endian::write32le(head + 4, CACHE_VERSION);
+    endian::write32le(head + 8, records.size());
+    endian::write64le(head + 16, HEADER_SIZE + table.size() + lists.size());
+    endian::write64le(head + 24, HEADER_SIZE + table.size());
+
+    // the old file is still mapped, and other runs may be reading it, so write
+    // a new one and move it over the old one. runs saving at the same time each
+    // get their own temporary file, so the one renamed last wins without mixing
+    buffer.reset();
+    count = first = last = 0;
+    int fd;
+    SmallString<128> temp;
+    if (sys::fs::createUniqueFile(path + "-%%%%%%.tmp", fd, temp))
+    {
+        return false;
+    }
+    {
+        raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out.write(head, HEADER_SIZE);
+        out << table << lists << strings;
+        out.close();
+        if (out.has_error())
+        {
+            out.clear_error();
+            sys::fs::remove(temp);
+            return false;
+        }
+    }
+    if (sys::fs::rename(temp, path))
+    {
+        sys::fs::remove(temp);
+        return false;
+    }
+    return true;
+}
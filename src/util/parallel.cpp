@@ -0,0 +1,46 @@
+#include <util/parallel.hpp>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+int resolveJobs(int jobs)
+{
+    if (jobs > 0)
+    {
+        return jobs;
+    }
+    return max(1u, thread::hardware_concurrency());
+}
+
+void parallelFor(int count, int jobs, const function<void(int)> &body)
+{
+    int numThreads = min(resolveJobs(jobs), count);
+    if (numThreads <= 1)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            body(i);
+        }
+        return;
+    }
+
+    // workers keep grabbing the next unprocessed index
+    atomic<int> next = 0;
+    vector<thread> workers;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        workers.emplace_back([&]()
+                             {
+                                 for (int i = next++; i < count; i = next++)
+                                 {
+                                     body(i);
+                                 } });
+    }
+    for (thread &worker : workers)
+    {
+        worker.join();
+    }
+}
@@ -1,12 +1,18 @@
 #include <util/symbols.hpp>
-#include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 using namespace std;
 using namespace clang;
+using namespace llvm;
 
 // constants
-const set<string> keywords = {
+const StringSet<> keywords = {
     "auto",
     "break",
     "case",
@@ -46,41 +52,120 @@ const set<string> keywords = {
     "_Imaginary",
 };
 
-/**
- * @brief Calculates the next number that can be used for an identifier
- *
- * @param i the current number requested
- * @return pair<int, string> a pair containing (nextNumber, identifier)
- */
-pair<int, string> toSymbol(int i, const set<string> &reserved, set<string> *defines)
+// letters first, so that the first 52 can start an identifier
+const char SYMBOL_CHARS[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+
+// every symbol name built so far, in fixed size chunks so that
+// readers never see storage move underneath them
+const int NAME_CHUNK_BITS = 12;
+const int NAME_CHUNK_SIZE = 1 << NAME_CHUNK_BITS;
+const int NAME_CHUNKS = 1 << 12;
+unique_ptr<string[]> nameChunks[NAME_CHUNKS];
+atomic<int> namesBuilt = 0;
+mutex namesMutex;
+
+const string &symbolName(int i)
 {
-    int curNum = i;
-    string result;
-    do
+    if (i < namesBuilt.load(memory_order_acquire))
     {
-        i = curNum;
-        vector<char> resultArr;
-        while (i >= 0)
+        return nameChunks[i >> NAME_CHUNK_BITS][i & (NAME_CHUNK_SIZE - 1)];
+    }
+
+    lock_guard<mutex> lock(namesMutex);
+    int built = namesBuilt.load(memory_order_relaxed);
+    assert(i < NAME_CHUNKS * NAME_CHUNK_SIZE && "ran out of symbol names");
+    for (; built <= i; ++built)
+    {
+        unique_ptr<string[]> &chunk = nameChunks[built >> NAME_CHUNK_BITS];
+        if (!chunk)
+        {
+            chunk = make_unique<string[]>(NAME_CHUNK_SIZE);
+        }
+
+        // the first character can be any letter, the ones after it digits and underscores too.
+        // count off the shorter names first, then write the rest back to front
+        int num = built;
+        int length = 1;
+        for (long long count = 52; num >= count; count *= 63)
         {
-            int tmp = i % 52; // use every lowercase and uppercase letter
-            if (tmp < 26)
-            {
-                resultArr.push_back('a' + tmp);
-            }
-            else
-            {
-                resultArr.push_back('A' + tmp - 26);
-            }
-            i /= 52;
-            i -= 1;
+            num -= count;
+            ++length;
         }
-        reverse(resultArr.begin(), resultArr.end());
-        result = string(resultArr.begin(), resultArr.end());
-        ++curNum;
+        char buffer[8];
+        char *start = end(buffer) - length;
+        for (int pos = length - 1; pos > 0; --pos)
+        {
+            start[pos] = SYMBOL_CHARS[num % 63];
+            num /= 63;
+        }
+        start[0] = SYMBOL_CHARS[num];
+        chunk[built & (NAME_CHUNK_SIZE - 1)].assign(start, end(buffer));
+    }
+    namesBuilt.store(built, memory_order_release);
+    return nameChunks[i >> NAME_CHUNK_BITS][i & (NAME_CHUNK_SIZE - 1)];
+}
 
-        // keep going while this is a keyword or reserved identifier
-    } while (keywords.find(result) != keywords.end() || reserved.find(result) != reserved.end() || defines->find(result) != defines->end());
-    return {curNum, result};
+int symbolNumber(StringRef name)
+{
+    // shorter names come first, then the characters are digits with the first one most significant
+    const StringRef chars(SYMBOL_CHARS, 63);
+    if (name.empty() || chars.find(name[0]) >= 52)
+    {
+        return -1;
+    }
+    long long num = chars.find(name[0]);
+    long long shorter = 0;
+    long long count = 52;
+    for (char c : name.drop_front())
+    {
+        size_t digit = chars.find(c);
+        if (digit == StringRef::npos)
+        {
+            return -1;
+        }
+        num = num * 63 + digit;
+        shorter += count;
+        count *= 63;
+        if (shorter + num > INT_MAX)
+        {
+            return -1;
+        }
+    }
+    return shorter + num;
+}
+
+pair<int, string> toSymbol(int i, const function<bool(StringRef)> &isTaken)
+{
+    // keep going while this is a keyword or taken identifier
+    while (true)
+    {
+        const string &result = symbolName(i++);
+        if (!keywords.contains(result) && !isTaken(result))
+        {
+            return {i, result};
+        }
+    }
+}
+
+SymbolTable::SymbolTable(const StringSet<> *defines, function<bool(StringRef)> isTaken) : defines(defines), isTaken(isTaken) {}
+
+bool SymbolTable::isUsable(StringRef name) const
+{
+    return !keywords.contains(name) && !defines->contains(name) && !isTaken(name);
+}
+
+int SymbolTable::number(int index)
+{
+    while (numbers.size() <= index)
+    {
+        int num = numbers.empty() ? 0 : numbers.back() + 1;
+        while (!isUsable(symbolName(num)))
+        {
+            ++num;
+        }
+        numbers.push_back(num);
+    }
+    return numbers[index];
 }
 
 bool isPunctuator(const Token &t)
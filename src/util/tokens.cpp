@@ -0,0 +1,162 @@
+#include <util/tokens.hpp>
+#include <util/symbols.hpp>
+#include <clang/Basic/LangOptions.h>
+#include <clang/Lex/Lexer.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/StringSaver.h>
+
+using namespace std;
+using namespace clang;
+using namespace llvm;
+
+TokenStream::TokenStream() : storage(make_shared<BumpPtrAllocator>()) {}
+
+uint32_t TokenStream::intern(StringRef spelling)
+{
+    auto it = numbers.find(spelling);
+    if (it != numbers.end())
+    {
+        return it->second;
+    }
+    StringRef saved = StringSaver(*storage).save(spelling);
+    numbers[saved] = spellings.size();
+    spellings.push_back(saved);
+    return spellings.size() - 1;
+}
+
+// the length of the backslash-newline at p, or 0 if there isn't one. like clang,
+// whitespace may come between the backslash and the newline
+size_t escapedNewlineLength(const char *p, const char *end)
+{
+    const char *q = p + 1;
+    while (q < end && (*q == ' ' || *q == '\t' || *q == '\f' || *q == '\v'))
+    {
+        ++q;
+    }
+    if (q >= end || (*q != '\n' && *q != '\r'))
+    {
+        return 0;
+    }
+    // \r\n and \n\r both count as one newline
+    if (q + 1 < end && (q[1] == '\n' || q[1] == '\r') && q[1] != *q)
+    {
+        ++q;
+    }
+    return q + 1 - p;
+}
+
+// what Lexer::getSpelling gives for a token that needs cleaning, without a SourceManager
+void cleanSpelling(StringRef raw, SmallVectorImpl<char> &out)
+{
+    const char *p = raw.begin();
+    while (p < raw.end())
+    {
+        if (*p == '\\')
+        {
+            if (size_t length = escapedNewlineLength(p, raw.end()))
+            {
+                p += length;
+                continue;
+            }
+        }
+        out.push_back(*p++);
+    }
+}
+
+void lexTokens(StringRef code, TokenStream &stream, bool recordOffsets)
+{
+    LangOptions lo;
+    Lexer lexer(SourceLocation(), lo, code.begin(), code.begin(), code.end());
+    SmallString<64> cleaned;
+
+    Token tok;
+    const char *prevEnd = code.begin();
+    lexer.LexFromRawLexer(tok);
+    while (!tok.is(tok::eof))
+    {
+        // the lexer stops right after the token it just lexed
+        const char *start = lexer.getBufferLocation() - tok.getLength();
+        StringRef spelling(start, tok.getLength());
+        if (tok.needsCleaning())
+        {
+            cleaned.clear();
+            cleanSpelling(spelling, cleaned);
+            spelling = cleaned.str();
+        }
+
+        uint8_t flags = 0;
+        flags |= tok.isAtStartOfLine() ? TokenStream::StartOfLine : 0;
+        flags |= start != prevEnd ? TokenStream::LeadingSpace : 0;
+        flags |= isPunctuator(tok) ? TokenStream::Punctuator : 0;
+        stream.add(spelling, tok.getKind(), flags, recordOffsets ? start - code.begin() : TokenStream::NO_OFFSET);
+
+        // advance to next token
+        prevEnd = start + tok.getLength();
+        lexer.LexFromRawLexer(tok);
+    }
+}
+
+string renderTokens(const TokenStream &stream)
+{
+    // in order to minify a file, we need to remove spaces and comments.
+    // the lexer already dropped comments, so each token is written out
+    // with what should go between it and the previous token.
+    // that should be nothing if the current token or the previous token
+    // is a punctuator, otherwise a single space
+    const vector<TokenStream::Entry> &entries = stream.entries;
+    string output;
+    size_t length = entries.size();
+    for (const TokenStream::Entry &entry : entries)
+    {
+        length += stream.spelling(entry).size();
+    }
+    output.reserve(length);
+
+    bool wasPP = false; // true if last thing was from a preprocessor
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const TokenStream::Entry &cur = entries[i];
+        bool startOfLine = cur.flags & TokenStream::StartOfLine;
+        bool isFirstPP = cur.kind == tok::hash && startOfLine;
+        if (i == 0)
+        {
+            // no spaces between start of file and first token
+        }
+        else if (isFirstPP || (wasPP && startOfLine))
+        {
+            if (wasPP && startOfLine)
+            {
+                wasPP = false;
+            }
+            // need a newline between prev location and this location
+            output += '\n';
+        }
+        else if ((entries[i - 1].flags | cur.flags) & TokenStream::Punctuator)
+        {
+            // currently in a preprocessor, so need to be careful about moving
+            // punctuators here
+            // specifically, if the past 3 tokens are
+            // '#', 'define', and (some identifier), then that means that
+            // this is a define and we keep one space if there was any,
+            // since without it the macro would take arguments or change its body
+            if (wasPP && i >= 3 &&
+                entries[i - 3].kind == tok::hash && (entries[i - 3].flags & TokenStream::StartOfLine) &&
+                entries[i - 2].kind == tok::raw_identifier && stream.spelling(entries[i - 2]) == "define" &&
+                entries[i - 1].kind == tok::raw_identifier &&
+                (cur.flags & TokenStream::LeadingSpace))
+            {
+                output += ' ';
+            }
+            // normally, no spaces between punctuators and things
+        }
+        else
+        {
+            // both this and the previous are some sort of raw-identifiers
+            // so use a space
+            output += ' ';
+        }
+        output += stream.spelling(cur);
+        wasPP = wasPP || isFirstPP;
+    }
+    return output;
+}
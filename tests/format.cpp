@@ -0,0 +1,196 @@
+#include <actions/FormatAction.hpp>
+#include <util/format.hpp>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace llvm;
+
+// checks that every scanner path of formatStream writes exactly what FormatAction::format does
+
+static int failures = 0;
+
+void check(bool ok, const string &what)
+{
+    if (!ok)
+    {
+        errs() << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+const char *pathName(FormatPath path)
+{
+    const char *names[] = {"detect", "scalar", "sse4.2", "avx2"};
+    return names[(int)path];
+}
+
+// formatStream reads a FILE, so the code goes through a temporary one
+string formatThrough(const string &code, FormatPath path)
+{
+    FILE *in = tmpfile();
+    if (in == nullptr)
+    {
+        return "(no temporary file)";
+    }
+    fwrite(code.data(), 1, code.size(), in);
+    rewind(in);
+    string result;
+    raw_string_ostream out(result);
+    if (!formatStream(in, out, path))
+    {
+        result = "(reading failed)";
+    }
+    out.flush();
+    fclose(in);
+    return result;
+}
+
+void checkCode(const string &code, const string &what)
+{
+    // std::string keeps a null character after its contents, which format needs
+    string expected = FormatAction::format(code);
+    for (FormatPath path : {FormatPath::Scalar, FormatPath::SSE42, FormatPath::AVX2})
+    {
+        if (!formatPathSupported(path))
+        {
+            continue;
+        }
+        string actual = formatThrough(code, path);
+        if (actual != expected)
+        {
+            size_t at = std::mismatch(actual.begin(), actual.begin() + min(actual.size(), expected.size()), expected.begin()).first - actual.begin();
+            check(false, what + " with " + pathName(path) + ": differs from FormatAction at output byte " + to_string(at) +
+                             ", expected \"" + expected.substr(at, 40) + "\", got \"" + actual.substr(at, 40) + "\"");
+        }
+    }
+}
+
+// formatStream reads the input 1 MiB at a time and scans each read up to 64 bytes before its end
+const size_t BLOCK_SIZE = 1 << 20;
+const size_t LOOKAHEAD = 64;
+
+// inputs the examples may never contain, each tried at every alignment of the 64 byte windows
+void checkCrafted()
+{
+    vector<pair<string, string>> cases = {
+        {"", "an empty file"},
+        {"int ab\\\ncd = 1;\n", "a line splice inside an identifier"},
+        {"a /\\\n* comment *\\\n/ b\n", "line splices inside /* and */"},
+        {"a // comment \\\n continued\nb\n", "a line splice continuing a // comment"},
+        {"a /\\\n/ comment\nb\n", "a line splice inside //"},
+        {"a //* not a block comment\nb = c / *d;\n", "//*"},
+        {"a = b //*/ c\n;\n", "//*/"},
+        {"a = \"unterminated", "an unterminated string at the end of the file"},
+        {"a = \"escaped\\\\\\\"", "an unterminated string ending in an escaped quote"},
+        {"a = 'x", "an unterminated character at the end of the file"},
+        {"a /* unterminated", "an unterminated block comment at the end of the file"},
+        {"a /* unterminated *", "an unterminated block comment ending in *"},
+        {"a = b /", "a slash at the end of the file"},
+        {"a = 1e\\\n+5;\n", "a line splice inside a pp-number"},
+    };
+    for (auto &[code, what] : cases)
+    {
+        for (size_t shift = 0; shift <= LOOKAHEAD; ++shift)
+        {
+            checkCode(string(shift, ' ') + code, what + " after " + to_string(shift) + " spaces");
+        }
+    }
+
+    // directives only count at the start of a line, including one that starts a window
+    for (size_t at = LOOKAHEAD - 2; at <= 2 * LOOKAHEAD + 2; ++at)
+    {
+        string code = "int a;" + string(at - 7, ' ') + "\n#define B 1\nint c = B;\n";
+        checkCode(code, "a directive at byte " + to_string(at));
+    }
+
+    // a pp-number cut by the end of a read or by the end of the scanned part of it
+    string filler;
+    while (filler.size() < BLOCK_SIZE - 2 * LOOKAHEAD)
+    {
+        filler += "int a = b + c;\n";
+    }
+    for (size_t edge : {BLOCK_SIZE - LOOKAHEAD, BLOCK_SIZE})
+    {
+        for (size_t at = edge - 4; at <= edge + 1; ++at)
+        {
+            // more code follows, so the first read ends at the block
+            string code = filler + string(at - filler.size() - 4, ' ') + "x = 1e+5 + y;\n" + filler;
+            checkCode(code, "1e+5 starting at byte " + to_string(at));
+        }
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc != 2)
+    {
+        errs() << "usage: " << argv[0] << " <examples directory>\n";
+        return 2;
+    }
+
+    vector<string> files;
+    error_code ec;
+    for (sys::fs::recursive_directory_iterator it(argv[1], ec), end; it != end && !ec; it.increment(ec))
+    {
+        StringRef extension = sys::path::extension(it->path());
+        if (extension == ".c" || extension == ".h")
+        {
+            files.push_back(it->path());
+        }
+    }
+    llvm::sort(files);
+    check(!files.empty(), string("sources found in ") + argv[1]);
+    checkCrafted();
+
+    string all;
+    for (const string &file : files)
+    {
+        ErrorOr<unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(file);
+        if (!buffer)
+        {
+            check(false, file + ": " + buffer.getError().message());
+            continue;
+        }
+        string code = buffer.get()->getBuffer().str();
+        checkCode(code, file);
+
+        // the block path works 64 bytes at a time, so every alignment of the code gets a turn
+        for (size_t shift = 1; shift < LOOKAHEAD; ++shift)
+        {
+            checkCode(string(shift, ' ') + code, file + " after " + to_string(shift) + " spaces");
+        }
+        string crlf;
+        for (char c : code)
+        {
+            crlf += c == '\n' ? "\r\n" : string(1, c);
+        }
+        checkCode(crlf, file + " with \\r\\n line ends");
+        all += code + "\n";
+    }
+
+    // past the 1 MiB the input is read in, so tokens, comments and directives get cut between reads
+    if (!all.empty())
+    {
+        string large;
+        while (large.size() < 5 * BLOCK_SIZE / 2)
+        {
+            large += all;
+        }
+        checkCode(large, "every example repeated to " + to_string(large.size()) + " bytes");
+    }
+
+    if (failures != 0)
+    {
+        errs() << failures << " checks failed\n";
+        return 1;
+    }
+    outs() << "all format checks passed\n";
+    return 0;
+}
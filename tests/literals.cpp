@@ -0,0 +1,348 @@
+#include <util/literals.hpp>
+#include <llvm/Support/raw_ostream.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace llvm;
+
+// checks that the spellings util/literals picks read back as the same value and type
+
+static int failures = 0;
+
+void check(bool ok, const string &what)
+{
+    if (!ok)
+    {
+        errs() << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+const char *typeName(IntegerType type)
+{
+    const char *names[] = {"int", "unsigned int", "long", "unsigned long", "long long", "unsigned long long"};
+    return names[(int)type];
+}
+
+unsigned widthOf(IntegerType type, const IntegerWidths &widths)
+{
+    switch (type)
+    {
+    case IntegerType::Int:
+    case IntegerType::UnsignedInt:
+        return widths.intWidth;
+    case IntegerType::Long:
+    case IntegerType::UnsignedLong:
+        return widths.longWidth;
+    default:
+        return widths.longLongWidth;
+    }
+}
+
+bool isSigned(IntegerType type)
+{
+    return type == IntegerType::Int || type == IntegerType::Long || type == IntegerType::LongLong;
+}
+
+// reads an integer literal back the way C does, with the candidate lists written out
+// as in the standard's table rather than derived, so they check the implementation
+optional<pair<uint64_t, IntegerType>> parseInteger(const string &spelling, const IntegerWidths &widths)
+{
+    using T = IntegerType;
+    size_t i = 0;
+    unsigned base = 10;
+    if (spelling.size() > 2 && spelling[0] == '0' && (spelling[1] == 'x' || spelling[1] == 'X'))
+    {
+        base = 16;
+        i = 2;
+    }
+    else if (spelling.size() > 1 && spelling[0] == '0')
+    {
+        base = 8;
+    }
+    size_t digitsEnd = i;
+    while (digitsEnd < spelling.size() && isxdigit((unsigned char)spelling[digitsEnd]) &&
+           (base == 16 || isdigit((unsigned char)spelling[digitsEnd])))
+    {
+        ++digitsEnd;
+    }
+    if (digitsEnd == i)
+    {
+        return nullopt;
+    }
+    string suffix = spelling.substr(digitsEnd);
+    for (char &c : suffix)
+    {
+        c = tolower(c);
+    }
+    errno = 0;
+    uint64_t value = strtoull(spelling.substr(i, digitsEnd - i).c_str(), nullptr, base);
+    if (errno != 0)
+    {
+        return nullopt;
+    }
+
+    bool decimal = base == 10;
+    vector<T> candidates;
+    if (suffix.empty())
+    {
+        candidates = decimal ? vector<T>{T::Int, T::Long, T::LongLong}
+                             : vector<T>{T::Int, T::UnsignedInt, T::Long, T::UnsignedLong, T::LongLong, T::UnsignedLongLong};
+    }
+    else if (suffix == "u")
+    {
+        candidates = {T::UnsignedInt, T::UnsignedLong, T::UnsignedLongLong};
+    }
+    else if (suffix == "l")
+    {
+        candidates = decimal ? vector<T>{T::Long, T::LongLong}
+                             : vector<T>{T::Long, T::UnsignedLong, T::LongLong, T::UnsignedLongLong};
+    }
+    else if (suffix == "ul" || suffix == "lu")
+    {
+        candidates = {T::UnsignedLong, T::UnsignedLongLong};
+    }
+    else if (suffix == "ll")
+    {
+        candidates = decimal ? vector<T>{T::LongLong} : vector<T>{T::LongLong, T::UnsignedLongLong};
+    }
+    else if (suffix == "ull" || suffix == "llu")
+    {
+        candidates = {T::UnsignedLongLong};
+    }
+    else
+    {
+        return nullopt;
+    }
+    for (T type : candidates)
+    {
+        unsigned bits = widthOf(type, widths) - (isSigned(type) ? 1 : 0);
+        if (bits >= 64 || value < (uint64_t(1) << bits))
+        {
+            return make_pair(value, type);
+        }
+    }
+    return nullopt;
+}
+
+void checkInteger(uint64_t value, IntegerType type, const IntegerWidths &widths, const string &expected = "")
+{
+    string spelling = shortestIntegerLiteral(value, type, widths);
+    string what = to_string(value) + " as " + typeName(type) + " gave \"" + spelling + "\"";
+    if (!expected.empty() || spelling.empty())
+    {
+        check(spelling == expected, what + ", expected \"" + expected + "\"");
+        if (spelling.empty())
+        {
+            return;
+        }
+    }
+    optional<pair<uint64_t, IntegerType>> parsed = parseInteger(spelling, widths);
+    check(parsed && parsed->first == value && parsed->second == type, what + ", which reads back differently");
+    check(spelling.back() != 'e' && spelling.back() != 'E', what + ", which merges with a following + or -");
+}
+
+void checkIntegers()
+{
+    using T = IntegerType;
+    IntegerWidths lp64;
+    checkInteger(0, T::Int, lp64, "0");
+    checkInteger(16, T::Int, lp64, "16");
+    checkInteger(1, T::Long, lp64, "1l");
+    checkInteger(1, T::UnsignedInt, lp64, "1u");
+    checkInteger(1, T::UnsignedLongLong, lp64, "1ull");
+    checkInteger(4294967295, T::UnsignedInt, lp64, "0xffffffff");
+    // unsuffixed decimal literals are never unsigned, hex ones may be
+    checkInteger(2147483648, T::Long, lp64, "2147483648");
+    checkInteger(2147483648, T::UnsignedInt, lp64, "0x80000000");
+    checkInteger(4294967296, T::Long, lp64, "4294967296");
+    // the shortest hex spelling ends in e
+    checkInteger(0xeeeeeeee, T::UnsignedInt, lp64, "4008636142u");
+    // no spelling has a type the value doesn't fit in
+    checkInteger(UINT64_MAX, T::LongLong, lp64, "");
+    checkInteger(UINT64_MAX, T::UnsignedLong, lp64, "0xffffffffffffffff");
+    checkInteger(UINT64_MAX, T::UnsignedLongLong, lp64, "0xffffffffffffffffll");
+    checkInteger(1, T::Int, IntegerWidths{16, 32, 64}, "1");
+    checkInteger(40000, T::Long, IntegerWidths{16, 32, 64}, "40000");
+    checkInteger(40000, T::UnsignedInt, IntegerWidths{16, 32, 64}, "40000u");
+
+    // every type for values around each power of two, on a few data models
+    const IntegerWidths models[] = {lp64, IntegerWidths{32, 32, 64}, IntegerWidths{16, 32, 64}};
+    for (const IntegerWidths &widths : models)
+    {
+        for (unsigned bit = 0; bit < 64; ++bit)
+        {
+            for (int delta : {-1, 0, 1})
+            {
+                uint64_t value = (uint64_t(1) << bit) + delta;
+                for (int type = 0; type <= (int)T::UnsignedLongLong; ++type)
+                {
+                    // a value with no spelling of this type is checked to give none
+                    unsigned bits = widthOf((T)type, widths) - (isSigned((T)type) ? 1 : 0);
+                    bool fits = bits >= 64 || value < (uint64_t(1) << bits);
+                    string spelling = shortestIntegerLiteral(value, (T)type, widths);
+                    if (!fits)
+                    {
+                        check(spelling.empty(), to_string(value) + " has no " + typeName((T)type) + " spelling, but gave \"" + spelling + "\"");
+                        continue;
+                    }
+                    if (!spelling.empty())
+                    {
+                        checkInteger(value, (T)type, widths);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// the byte a plain character literal stands for
+optional<unsigned char> parseCharacter(const string &spelling)
+{
+    if (spelling.size() < 3 || spelling.front() != '\'' || spelling.back() != '\'')
+    {
+        return nullopt;
+    }
+    string body = spelling.substr(1, spelling.size() - 2);
+    if (body.size() == 1 && body[0] != '\\' && body[0] != '\'')
+    {
+        return (unsigned char)body[0];
+    }
+    if (body.size() < 2 || body[0] != '\\')
+    {
+        return nullopt;
+    }
+    const string escapes = "abfnrtv\\'";
+    const string values = "\a\b\f\n\r\t\v\\'";
+    if (body.size() == 2 && escapes.find(body[1]) != string::npos)
+    {
+        return (unsigned char)values[escapes.find(body[1])];
+    }
+    if (body.size() > 4 || body.find_first_not_of("01234567", 1) != string::npos)
+    {
+        return nullopt;
+    }
+    unsigned value = stoul(body.substr(1), nullptr, 8);
+    return value <= 0xff ? optional<unsigned char>(value) : nullopt;
+}
+
+void checkCharacters()
+{
+    check(shortestCharacterLiteral('a', false) == "'a'", "'a' in C++");
+    check(shortestCharacterLiteral('a', true) == "97", "'a' in C");
+    check(shortestCharacterLiteral('\n', false) == "'\\n'", "'\\n' in C++");
+    check(shortestCharacterLiteral('\'', false) == "'\\''", "a quote");
+    check(shortestCharacterLiteral(0, false) == "'\\0'", "a null character");
+    check(shortestCharacterLiteral(0, true) == "0", "a null character in C");
+    // with a signed char, '\377' is -1, which no int literal spells
+    check(shortestCharacterLiteral(UINT32_MAX, true) == "'\\377'", "a negative character");
+    check(shortestCharacterLiteral(0xff, true) == "255", "an unsigned character");
+    check(shortestCharacterLiteral(0x6162, true).empty(), "a multi-character literal");
+
+    for (unsigned c = 0; c <= 0xff; ++c)
+    {
+        for (uint32_t value : {(uint32_t)c, (uint32_t)(int32_t)(signed char)c})
+        {
+            for (bool integerAllowed : {false, true})
+            {
+                string spelling = shortestCharacterLiteral(value, integerAllowed);
+                string what = string("character ") + to_string(value) + " gave \"" + spelling + "\"";
+                if (spelling.front() != '\'')
+                {
+                    check(integerAllowed && to_string(value) == spelling, what + ", which isn't its value");
+                    continue;
+                }
+                optional<unsigned char> parsed = parseCharacter(spelling);
+                check(parsed && *parsed == c, what + ", which reads back differently");
+            }
+        }
+    }
+}
+
+void checkFloating(double value, const string &expected = "")
+{
+    string spelling = shortestFloatingLiteral(APFloat(value), "");
+    string what = string("double ") + to_string(value) + " gave \"" + spelling + "\"";
+    if (!expected.empty())
+    {
+        check(spelling == expected, what + ", expected \"" + expected + "\"");
+    }
+    check(spelling.find_first_of(".e") != string::npos, what + ", which isn't a floating literal");
+    double parsed = strtod(spelling.c_str(), nullptr);
+    check(memcmp(&parsed, &value, sizeof(double)) == 0, what + ", which reads back differently");
+}
+
+void checkFloat(float value, const string &expected = "")
+{
+    string spelling = shortestFloatingLiteral(APFloat(value), "f");
+    string what = string("float ") + to_string(value) + " gave \"" + spelling + "\"";
+    if (!expected.empty())
+    {
+        check(spelling == expected, what + ", expected \"" + expected + "\"");
+    }
+    check(spelling.size() > 1 && spelling.back() == 'f' && spelling.find_first_of(".e") != string::npos, what + ", which isn't a float literal");
+    float parsed = strtof(spelling.c_str(), nullptr);
+    check(memcmp(&parsed, &value, sizeof(float)) == 0, what + ", which reads back differently");
+}
+
+void checkFloatings()
+{
+    checkFloating(0.0, "0.");
+    checkFloating(1.0, "1.");
+    checkFloating(1.5, "1.5");
+    checkFloating(0.1, ".1");
+    checkFloating(0.001, ".001");
+    checkFloating(0.0001, "1e-4");
+    checkFloating(10.0, "10.");
+    checkFloating(100.0, "1e2");
+    checkFloating(1000000.0, "1e6");
+    checkFloating(123456.0, "123456.");
+    checkFloating(1e300);
+    checkFloating(5e-324);
+    checkFloating(1.7976931348623157e308);
+    checkFloat(0.1f, ".1f");
+    checkFloat(3.4028235e38f);
+    check(shortestFloatingLiteral(APFloat(-1.0), "").empty(), "a negative double");
+    check(shortestFloatingLiteral(APFloat::getInf(APFloat::IEEEdouble()), "").empty(), "an infinite double");
+    check(shortestFloatingLiteral(APFloat::getNaN(APFloat::IEEEdouble()), "").empty(), "a NaN double");
+
+    // random finite values, so the digit search and the exponent handling both get exercised
+    mt19937_64 random(42);
+    for (int i = 0; i < 20000; ++i)
+    {
+        uint64_t bits = random() & ~(uint64_t(1) << 63);
+        double value;
+        memcpy(&value, &bits, sizeof(double));
+        if (isfinite(value))
+        {
+            checkFloating(value);
+        }
+        uint32_t floatBits = (uint32_t)bits & 0x7fffffff;
+        float floatValue;
+        memcpy(&floatValue, &floatBits, sizeof(float));
+        if (isfinite(floatValue))
+        {
+            checkFloat(floatValue);
+        }
+    }
+}
+
+int main()
+{
+    checkIntegers();
+    checkCharacters();
+    checkFloatings();
+    if (failures != 0)
+    {
+        errs() << failures << " checks failed\n";
+        return 1;
+    }
+    outs() << "all literal checks passed\n";
+    return 0;
+}